@@ -0,0 +1,450 @@
+/** @file InlineSortedArray.hpp
+ * Header-only sorted array with the comparison inlined into the search code.
+ *
+ * SortedArray forwards every call into libsarr.so and compares elements through a function pointer,
+ * so every probe of a binary search is an indirect call across a shared library boundary.
+ * InlineSortedArray runs the same search and shift algorithms as sorted_array.cpp,
+ * but takes a @p Compare functor as a template parameter, so the compiler can inline each comparison.
+ *
+ * Unlike SortedArray, which moves elements as raw bytes, InlineSortedArray keeps them as objects of type @p T,
+ * so it can hold types like std::string or std::unique_ptr, which are moved instead of copied.
+ */
+
+#ifndef INLINE_SORTED_ARRAY_HPP
+#define INLINE_SORTED_ARRAY_HPP
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Whether objects of @p T can be moved to another address by copying their bytes, forgetting the old ones.
+ *
+ * InlineSortedArray shifts and grows arrays of such types with memmove() and realloc(), and other types
+ * with move construction and assignment. It's true for trivially copyable types, and can be specialized
+ * for others, that don't point into themselves (e.g. std::unique_ptr, but not std::string of libstdc++).
+ */
+template <typename T> struct sa_relocatable : std::is_trivially_copyable<T> {};
+
+/**
+ * Sorted array of @p T ordered by @p Compare, that doesn't depend on libsarr.so.
+ *
+ * Errors are reported the same way SortedArray does, by throwing an errno code.
+ * @see SortedArray
+ */
+template <typename T, typename Compare = std::less<T>> class InlineSortedArray
+{
+	static_assert(alignof(T) <= alignof(max_align_t), "InlineSortedArray allocates its buffer with malloc()");
+
+	static constexpr bool relocatable = sa_relocatable<T>::value;
+
+public:
+	inline InlineSortedArray(size_t maxElems, Compare compare = Compare()) :
+		buffer(NULL), n(0), maxElems(0), growable(false), less(compare)
+	{
+		resize(maxElems);
+	}
+
+	InlineSortedArray(const InlineSortedArray&) = delete;
+	InlineSortedArray& operator=(const InlineSortedArray&) = delete;
+
+	InlineSortedArray(InlineSortedArray&& other) noexcept :
+		buffer(other.buffer), n(other.n), maxElems(other.maxElems), growable(other.growable), less(std::move(other.less))
+	{
+		other.buffer = NULL;
+		other.n = 0;
+		other.maxElems = 0;
+	}
+
+	InlineSortedArray& operator=(InlineSortedArray&& other) noexcept
+	{
+		if (this != &other)
+		{
+			clear();
+			free(buffer);
+			buffer = other.buffer;
+			n = other.n;
+			maxElems = other.maxElems;
+			growable = other.growable;
+			less = std::move(other.less);
+			other.buffer = NULL;
+			other.n = 0;
+			other.maxElems = 0;
+		}
+		return *this;
+	}
+
+	~InlineSortedArray()
+	{
+		clear();
+		free(buffer);
+	}
+
+	inline void put(const T& elem)
+	{
+		put(T(elem));
+	}
+
+	/// Put @p elem, moving it into its place, so it is never copied.
+	inline void put(T&& elem)
+	{
+		ensureSpace(1);
+		size_t place = findPlaceRight(elem);
+		if (relocatable)
+		{
+			memmove((void*)(buffer + place + 1), (void*)(buffer + place), (n - place) * sizeof(T));
+			try
+			{
+				new (buffer + place) T(std::move(elem));
+			}
+			catch (...)
+			{
+				memmove((void*)(buffer + place), (void*)(buffer + place + 1), (n - place) * sizeof(T));
+				throw;
+			}
+		}
+		else if (place == n)
+			new (buffer + n) T(std::move(elem));
+		else
+		{
+			new (buffer + n) T(std::move(buffer[n - 1]));
+			n++;
+			std::move_backward(buffer + place, buffer + n - 2, buffer + n - 1);
+			buffer[place] = std::move(elem);
+			return;
+		}
+		n++;
+	}
+
+	/// Construct an element from @p args and put it. @see put(T&&)
+	template <typename... Args>
+	inline void emplace(Args&&... args)
+	{
+		put(T(std::forward<Args>(args)...));
+	}
+
+	/**
+	 * Put all elements of range [@p first, @p last) at once, merging them in one pass.
+	 *
+	 * Relocatable elements are merged in place from the end. Others are merged into a new buffer,
+	 * moving the stored ones only if that can't throw, so if a copy throws, the array is left as it was.
+	 * @see saputn()
+	 */
+	template <typename InputIt>
+	void put(InputIt first, InputIt last)
+	{
+		std::vector<T> batch(first, last);
+		std::stable_sort(batch.begin(), batch.end(), less);
+		if (!relocatable)
+		{
+			mergeCopy(batch);
+			return;
+		}
+		ensureSpace(batch.size());
+
+		// Slots from n on are raw memory, so they are constructed, and the others are assigned
+		size_t out = n + batch.size();
+		size_t i = n;
+		size_t j = batch.size();
+		while (j > 0)
+		{
+			T& from = i > 0 && less(batch[j - 1], buffer[i - 1]) ? buffer[--i] : batch[--j];
+			if (--out >= n)
+				new (buffer + out) T(std::move(from));
+			else
+				buffer[out] = std::move(from);
+		}
+		n += batch.size();
+	}
+
+	inline const T& get(size_t index) const
+	{
+		if (index >= n)
+			throw ERANGE;
+		return buffer[index];
+	}
+
+	inline void remove(size_t index)
+	{
+		if (index >= n)
+			throw ERANGE;
+		erase(index, index + 1);
+	}
+
+	inline void removeAll(const T& elem)
+	{
+		erase(findPlaceLeft(elem), findPlaceRight(elem));
+	}
+
+	inline size_t len() const
+	{
+		return n;
+	}
+
+	inline int cmp(size_t index, const T& elem) const
+	{
+		if (index >= n)
+			throw ERANGE;
+		if (less(buffer[index], elem))
+			return -1;
+		return less(elem, buffer[index]) ? 1 : 0;
+	}
+
+	inline size_t find(const T& elem) const
+	{
+		size_t place = findPlaceLeft(elem);
+		if (place == n || less(elem, buffer[place]))
+			throw ENOENT;
+		return place;
+	}
+
+	inline void resort()
+	{
+		std::sort(buffer, buffer + n, less);
+	}
+
+	template <typename Func>
+	void foreach(Func func)
+	{
+		for (size_t i = 0; i < n; i++)
+			func(buffer[i]);
+	}
+
+	/// @see sagrowable()
+	inline void setGrowable(bool growable)
+	{
+		this->growable = growable;
+	}
+
+	/// @see sareserve()
+	inline void reserve(size_t count)
+	{
+		if (count > maxElems)
+			resize(count);
+	}
+
+	/// @see sashrink()
+	inline void shrink()
+	{
+		resize(n);
+	}
+
+	friend std::ostream& operator<<(std::ostream &os, const InlineSortedArray &sa)
+	{
+		for (size_t i = 0; i < sa.n; i++)
+			os << sa.buffer[i] << ' ';
+		os << '\n';
+		return os;
+	}
+
+	inline const T& operator[](size_t index) const
+	{
+		return get(index);
+	}
+
+	template <size_t N>
+	bool operator==(T (&array)[N]) const
+	{
+		if (n != N)
+			return false;
+
+		for (size_t i = 0; i < N; i++)
+			if (cmp(i, array[i]) != 0)
+				return false;
+
+		return true;
+	}
+
+	template <size_t N>
+	inline bool operator!=(T (&array)[N]) const
+	{
+		return !operator==(array);
+	}
+
+private:
+	/// Find the first element >= @p elem
+	size_t findPlaceLeft(const T& elem) const
+	{
+		if (n == 0)
+			return 0;
+		if (!less(buffer[0], elem))
+			return 0;
+		if (less(buffer[n - 1], elem))
+			return n;
+
+		size_t left = 0;
+		size_t right = n - 1;
+		while (left + 1 < right)
+		{
+			size_t center = (left + right) / 2;
+			if (less(buffer[center], elem))
+				left = center;
+			else
+				right = center;
+		}
+		return right;
+	}
+
+	/// Find the first element > @p elem
+	size_t findPlaceRight(const T& elem) const
+	{
+		if (n == 0)
+			return 0;
+		if (less(elem, buffer[0]))
+			return 0;
+		if (!less(elem, buffer[n - 1]))
+			return n;
+
+		size_t left = 0;
+		size_t right = n - 1;
+		while (left + 1 < right)
+		{
+			size_t center = (left + right) / 2;
+			if (!less(elem, buffer[center]))
+				left = center;
+			else
+				right = center;
+		}
+		return right;
+	}
+
+	/// Remove elements in [@p from, @p to), shifting the following ones left.
+	void erase(size_t from, size_t to)
+	{
+		if (relocatable)
+		{
+			for (size_t i = from; i < to; i++)
+				buffer[i].~T();
+			memmove((void*)(buffer + from), (void*)(buffer + to), (n - to) * sizeof(T));
+		}
+		else
+		{
+			std::move(buffer + to, buffer + n, buffer + from);
+			for (size_t i = n - (to - from); i < n; i++)
+				buffer[i].~T();
+		}
+		n -= to - from;
+	}
+
+	void clear()
+	{
+		if (!std::is_trivially_destructible<T>::value)
+			for (size_t i = 0; i < n; i++)
+				buffer[i].~T();
+		n = 0;
+	}
+
+	/// Merge sorted @p batch with the stored elements into a new buffer, keeping the old one until it's complete.
+	void mergeCopy(std::vector<T>& batch)
+	{
+		size_t count = n + batch.size();
+		size_t cap = maxElems;
+		if (batch.size() > maxElems - n)
+		{
+			if (!growable)
+				throw ENOBUFS;
+			cap = grownCapacity(batch.size());
+		}
+
+		T* p = (T*) malloc(cap ? cap * sizeof(T) : 1);
+		if (p == NULL)
+			throw ENOMEM;
+
+		// Equal elements keep the stored ones first, as in put(T&&)
+		size_t out = 0;
+		size_t i = 0;
+		size_t j = 0;
+		try
+		{
+			for (; out < count; out++)
+			{
+				if (i == n || (j < batch.size() && less(batch[j], buffer[i])))
+					new (p + out) T(std::move(batch[j++]));
+				else
+					new (p + out) T(std::move_if_noexcept(buffer[i++]));
+			}
+		}
+		catch (...)
+		{
+			while (out > 0)
+				p[--out].~T();
+			free(p);
+			throw;
+		}
+		clear();
+		free(buffer);
+		buffer = p;
+		n = count;
+		maxElems = cap;
+	}
+
+	/// Move the elements to a buffer of @p count elements. Relocatable ones are moved by realloc().
+	void resize(size_t count)
+	{
+		if (relocatable)
+		{
+			T* p = (T*) realloc((void*)buffer, count ? count * sizeof(T) : 1);
+			if (p == NULL)
+				throw ENOMEM;
+			buffer = p;
+		}
+		else
+		{
+			T* p = (T*) malloc(count ? count * sizeof(T) : 1);
+			if (p == NULL)
+				throw ENOMEM;
+
+			// The old elements are kept until all new ones are constructed, in case a copy throws
+			size_t i = 0;
+			try
+			{
+				for (; i < n; i++)
+					new (p + i) T(std::move_if_noexcept(buffer[i]));
+			}
+			catch (...)
+			{
+				while (i > 0)
+					p[--i].~T();
+				free(p);
+				throw;
+			}
+			for (i = 0; i < n; i++)
+				buffer[i].~T();
+			free(buffer);
+			buffer = p;
+		}
+		maxElems = count;
+	}
+
+	void ensureSpace(size_t count)
+	{
+		if (count <= maxElems - n)
+			return;
+		if (!growable)
+			throw ENOBUFS;
+		resize(grownCapacity(count));
+	}
+
+	/// Get the capacity to grow to, when @p count more elements are needed. It at least doubles.
+	size_t grownCapacity(size_t count) const
+	{
+		return std::max(std::max(maxElems * 2, (size_t)16), n + count);
+	}
+
+	T* buffer;
+	size_t n;
+	size_t maxElems;
+	bool growable;
+	Compare less;
+};
+
+#endif
@@ -7,25 +7,67 @@
 #include "sorted_array.h"
 
 #include <iostream>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <optional>
+#endif
 
 /**
  * Sorted array wrapper class
+ *
+ * The library copies and shifts elements as raw bytes, so @p T must be trivially copyable.
+ * Use InlineSortedArray for other types.
  * @see sorted_array
  */
 template <typename T> class SortedArray
 {
+	static_assert(std::is_trivially_copyable<T>::value, "SortedArray stores elements byte-wise, use InlineSortedArray");
+
 public:
 	inline SortedArray(size_t maxElems, int (*compar)(const void* a, const void* b))
 	{
 		array = sanew(sizeof(T), maxElems, compar);
-		if (errno != 0)
+		if (array == NULL)
+			throw errno;
+	}
+
+	/// @see sanew_ex()
+	inline SortedArray(size_t maxElems, int (*compar)(const void* a, const void* b), 
+		const struct sa_allocator* allocator, int flags = 0)
+	{
+		array = sanew_ex(sizeof(T), maxElems, compar, allocator, flags);
+		if (array == NULL)
+			throw errno;
+	}
+
+	/**
+	 * Open an array stored in a file. The caller deletes it.
+	 * @see saopen()
+	 */
+	static SortedArray* open(const char* path, int flags, size_t maxElems, int (*compar)(const void* a, const void* b))
+	{
+		struct sorted_array* array = saopen(path, sizeof(T), maxElems, compar, flags);
+		if (array == NULL)
+			throw errno;
+		return new SortedArray(array);
+	}
+
+	/**
+	 * Load an array saved by save(). The caller deletes it.
+	 * @see saload()
+	 */
+	static SortedArray* load(FILE* in, int (*compar)(const void* a, const void* b))
+	{
+		struct sorted_array* array = saload(in, compar);
+		if (array == NULL)
 			throw errno;
+		return new SortedArray(array);
 	}
 
 	~SortedArray()
 	{
-		for (Iterator it(*this); !it.isEnd(); it.next())
-			it.get().~T();
 		sadelete(array);
 	}
 
@@ -35,15 +77,83 @@ public:
 		if (errno != 0)
 			throw errno;
 	}
+
+	/**
+	 * Put all elements of range [@p first, @p last) at once.
+	 * @see saputn()
+	 */
+	template <typename InputIt>
+	inline void put(InputIt first, InputIt last)
+	{
+		std::vector<T> batch(first, last);
+		saputn(array, batch.data(), batch.size());
+		if (errno != 0)
+			throw errno;
+	}
 	
 	inline T get(size_t index) 
 	{ 
-		T* t = (T*)saget(array, index); 
+		alignas(T) unsigned char t[sizeof(T)];
+		saread(array, index, index + 1, t);
 		if (errno == 0)
-			return *t;
+			return *(T*)t;
 		else 
 			throw errno;
 	}
+
+	/**
+	 * Get a reference to an element without checking @p index and without touching errno.
+	 * The reference stays valid until the next modification of the array, so the array must not be concurrent.
+	 * @see saget_unchecked()
+	 */
+	inline const T& getUnchecked(size_t index)
+	{
+		return *(const T*)saget_unchecked(array, index);
+	}
+
+#if __cplusplus >= 201703L
+	/**
+	 * Get a copy of an element, or nothing if @p index is out of bounds. Never throws and never touches errno.
+	 * The bounds check and the copy are one consistent read, so this works for concurrent arrays too.
+	 * @see saread()
+	 */
+	inline std::optional<T> tryGet(size_t index)
+	{
+		alignas(T) unsigned char elem[sizeof(T)];
+		int saved = errno;
+		int res = saread(array, index, index + 1, elem);
+		errno = saved;
+		if (res != 0)
+			return std::nullopt;
+		return *(const T*)elem;
+	}
+
+	/**
+	 * Find the first occurence of an element, or nothing if it is absent. Never throws and never touches errno.
+	 * Works for concurrent arrays too, as the search is one consistent read.
+	 * @see safind_unchecked()
+	 */
+	inline std::optional<size_t> tryFind(T elem)
+	{
+		size_t index = safind_unchecked(array, &elem);
+		if (index == (size_t)-1)
+			return std::nullopt;
+		return index;
+	}
+#endif
+
+	/// Check whether the array holds an element equal to @p elem. Never throws and never touches errno, works for concurrent arrays too.
+	inline bool contains(T elem)
+	{
+		return safind_unchecked(array, &elem) != (size_t)-1;
+	}
+
+	/// @see saread()
+	inline void read(size_t from, size_t to, T* out)
+	{
+		saread(array, from, to, out);
+		if (errno != 0) throw errno;
+	}
 	
 	inline void remove(size_t index) 
 	{
@@ -57,11 +167,122 @@ public:
 		sarmall(array, &elem); 
 	}
 
+	/**
+	 * Remove all elements for which @p pred returns true.
+	 * @see sarmif()
+	 */
+	template <typename Pred>
+	void removeIf(Pred pred)
+	{
+		sarmif(array, [](void* elem, void* context) -> int { return (*(Pred*)context)(*(T*)elem); }, &pred);
+		if (errno != 0) throw errno;
+	}
+
+	/// @see sarmrange()
+	inline void removeRange(size_t from, size_t to)
+	{
+		sarmrange(array, from, to);
+		if (errno != 0)
+			throw errno;
+	}
+
 	inline size_t len()	
 	{ 
 		return salen(array); 
 	}
 
+	/// @see sagrowable()
+	inline void setGrowable(bool growable)
+	{
+		sagrowable(array, growable);
+	}
+
+	/// @see saindex()
+	inline void setIndexed(bool indexed)
+	{
+		saindex(array, indexed);
+		if (errno != 0) throw errno;
+	}
+
+	/// @see sakeytype()
+	inline void setKeyType(enum sa_key_type type)
+	{
+		sakeytype(array, type);
+		if (errno != 0)
+			throw errno;
+	}
+
+	/// @see sablocks()
+	inline void setBlocked(size_t blockElems = 0)
+	{
+		sablocks(array, blockElems);
+		if (errno != 0)
+			throw errno;
+	}
+
+	/// @see sawbuffer()
+	inline void setWriteBuffer(size_t count)
+	{
+		sawbuffer(array, count);
+		if (errno != 0)
+			throw errno;
+	}
+
+	/// @see saflush()
+	inline void flush()
+	{
+		saflush(array);
+	}
+
+	/**
+	 * Take a snapshot of a blocked array. The caller deletes it.
+	 * @see sasnapshot()
+	 */
+	inline SortedArray* snapshot()
+	{
+		struct sorted_array* snap = sasnapshot(array);
+		if (snap == NULL)
+			throw errno;
+		return new SortedArray(snap);
+	}
+
+	/// @see sasync()
+	inline void sync()
+	{
+		sasync(array);
+		if (errno != 0) throw errno;
+	}
+
+	/// @see sasave()
+	inline void save(FILE* out)
+	{
+		sasave(array, out);
+		if (errno != 0) throw errno;
+	}
+
+	/// @see saconcurrent()
+	inline void setConcurrent(bool concurrent)
+	{
+		saconcurrent(array, concurrent);
+		if (errno != 0) throw errno;
+	}
+
+	/// @see sareserve()
+	inline void reserve(size_t count)
+	{
+		sareserve(array, count);
+		if (errno != 0)
+			throw errno;
+	}
+
+	/// @see sashrink()
+	inline void shrink()
+	{
+		sashrink(array);
+		if (errno != 0)
+			throw errno;
+	}
+
 	inline int cmp(size_t index, T elem)
 	{
 		int res = sacmp(array, index, &elem);
@@ -80,9 +301,151 @@ public:
 			throw errno;
 	}
 	
+	/**
+	 * Contiguous view of a range of elements.
+	 * It stays valid until the next modification of the array.
+	 */
+	class Span
+	{
+	public:
+		Span(const T* first, const T* last) : first(first), last(last) {}
+
+		inline const T* begin() const	{ return first; }
+		inline const T* end() const		{ return last; }
+		inline size_t size() const		{ return last - first; }
+		inline bool empty() const		{ return first == last; }
+		inline const T& operator[](size_t index) const	{ return first[index]; }
+
+	private:
+		const T* first;
+		const T* last;
+	};
+
+	/**
+	 * Find @p count elements of @p keys, writing their indices or (size_t)-1 to @p indices.
+	 * @return A number of found elements.
+	 * @see safindn()
+	 */
+	inline size_t find(const T* keys, size_t count, size_t* indices)
+	{
+		size_t found = safindn(array, (void*)keys, count, indices);
+		if (errno != 0)
+			throw errno;
+		return found;
+	}
+
+	/// @see salower()
+	inline size_t lowerBound(T elem)
+	{
+		return salower(array, &elem);
+	}
+
+	/// @see saupper()
+	inline size_t upperBound(T elem)
+	{
+		return saupper(array, &elem);
+	}
+
+	/// @see sacount()
+	inline size_t count(T elem)
+	{
+		return sacount(array, &elem);
+	}
+
+	/**
+	 * Get a view of elements x with @p lo <= x <= @p hi.
+	 * @see sarange()
+	 */
+	Span range(T lo, T hi)
+	{
+		size_t begin, end;
+		sarange(array, &lo, &hi, &begin, &end);
+		const T* data = (const T*)sadata(array);
+		if (errno != 0)
+			throw errno;
+		return Span(data + begin, data + end);
+	}
+
+	/// Get a view of elements equal to @p elem.
+	inline Span equalRange(T elem)
+	{
+		return range(elem, elem);
+	}
+
+	typedef T value_type;
+	typedef const T& const_reference;
+	typedef const T* const_iterator;
+	typedef const_iterator iterator;
+	typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+	typedef const_reverse_iterator reverse_iterator;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	/**
+	 * Get a pointer to the contiguous buffer with all elements.
+	 *
+	 * Iterators of the array are plain pointers into this buffer, so a loop over them doesn't call into the library,
+	 * and STL algorithms, like std::lower_bound(), work on the array directly.
+	 * They stay valid until the next modification of the array.
+	 * Blocked arrays have no contiguous buffer, and throw EOPNOTSUPP; use Iterator for them.
+	 * @see sadata()
+	 */
+	inline const T* data()
+	{
+		const T* p = (const T*)sadata(array);
+		if (p == NULL)
+			throw errno;
+		return p;
+	}
+
+	inline const_iterator begin()	{ return data(); }
+	inline const_iterator end()		{ return data() + len(); }
+	inline const_iterator cbegin()	{ return begin(); }
+	inline const_iterator cend()	{ return end(); }
+
+	inline const_reverse_iterator rbegin()	{ return const_reverse_iterator(end()); }
+	inline const_reverse_iterator rend()	{ return const_reverse_iterator(begin()); }
+
+	inline size_t size()	{ return len(); }
+	inline bool empty()		{ return len() == 0; }
+
+	inline const T& front()
+	{
+		if (empty())
+			throw ERANGE;
+		return *begin();
+	}
+
+	inline const T& back()
+	{
+		if (empty())
+			throw ERANGE;
+		return *(end() - 1);
+	}
+
 	inline void resort() 
 	{ saresort(array); }
 
+	/// @see satouch()
+	inline void touch(size_t index)
+	{
+		satouch(array, index);
+		if (errno != 0) throw errno;
+	}
+
+	/// @see satouchrange()
+	inline void touch(size_t from, size_t to)
+	{
+		satouchrange(array, from, to);
+		if (errno != 0) throw errno;
+	}
+
+	/// @see sathreads()
+	inline void setThreads(size_t threads)
+	{
+		sathreads(array, threads);
+	}
+
 	void foreach(void (*func)(void* elem)) 
 	{ 
 		saforeach(array, func); 
@@ -135,6 +498,57 @@ public:
 		struct sa_iter* it;
 	};
 	
+	/**
+	 * Merge Iterator over many sorted arrays
+	 * @see sa_merge_iter
+	 */
+	class MergeIterator
+	{
+	public:
+		MergeIterator(SortedArray** arrays, size_t count)
+		{
+			std::vector<struct sorted_array*> raw = unwrap(arrays, count);
+			it = samnew(raw.data(), count);
+			if (it == NULL)
+				throw errno;
+		}
+
+		~MergeIterator()
+		{ samdelete(it); }
+
+		inline T get()
+		{
+			T* t = (T*)samget(it);
+			if (errno == 0)
+				return *t;
+			else
+				throw errno;
+		}
+
+		inline void next()
+		{
+			samnext(it);
+			if (errno != 0)
+				throw errno;
+		}
+		inline bool isEnd()	{ return samend(it); }
+
+	private:
+		struct sa_merge_iter* it;
+	};
+
+	/**
+	 * Replace the contents of this array with all elements of @p count @p arrays.
+	 * @see samerge()
+	 */
+	void merge(SortedArray** arrays, size_t count)
+	{
+		std::vector<struct sorted_array*> raw = unwrap(arrays, count);
+		samerge(array, raw.data(), count);
+		if (errno != 0)
+			throw errno;
+	}
+
 	friend std::ostream& operator<<(std::ostream &os, SortedArray &sa)
 	{
 		for (Iterator it(sa); !it.isEnd(); it.next())
@@ -169,5 +583,177 @@ public:
 	
 
 private:
+	inline explicit SortedArray(struct sorted_array* array) : array(array) {}
+
+	static std::vector<struct sorted_array*> unwrap(SortedArray** arrays, size_t count)
+	{
+		std::vector<struct sorted_array*> raw(count);
+		for (size_t i = 0; i < count; i++)
+			raw[i] = arrays[i]->array;
+		return raw;
+	}
+
 	struct sorted_array* array;
 };
+
+/**
+ * Sharded sorted array wrapper class
+ * @see sa_shards
+ */
+template <typename T> class ShardedArray
+{
+public:
+	inline ShardedArray(size_t shardElems, int (*compar)(const void* a, const void* b))
+	{
+		sh = sashnew(sizeof(T), shardElems, compar);
+		if (sh == NULL)
+			throw errno;
+	}
+
+	ShardedArray(const ShardedArray&) = delete;
+	ShardedArray& operator=(const ShardedArray&) = delete;
+
+	~ShardedArray()
+	{ sashdelete(sh); }
+
+	inline void put(T elem)
+	{
+		sashput(sh, &elem);
+		if (errno != 0) throw errno;
+	}
+
+	inline void removeAll(T elem)
+	{
+		sashrmall(sh, &elem);
+		if (errno != 0) throw errno;
+	}
+
+	inline T get(size_t index)
+	{
+		alignas(T) unsigned char t[sizeof(T)];
+		sashget(sh, index, t);
+		if (errno != 0) throw errno;
+		return *(T*)t;
+	}
+
+	inline size_t find(T elem)
+	{
+		size_t index = sashfind(sh, &elem);
+		if (errno != 0) throw errno;
+		return index;
+	}
+
+	inline size_t len()		{ return sashlen(sh); }
+	inline size_t shards()	{ return sashcount(sh); }
+
+	inline T operator[](size_t index)
+	{
+		return get(index);
+	}
+
+private:
+	struct sa_shards* sh;
+};
+
+/**
+ * Builder of an external array. The destructor finishes the build, if finish() was not called.
+ * @see sa_xbuilder
+ */
+template <typename T> class ExternalArrayBuilder
+{
+public:
+	inline ExternalArrayBuilder(const char* path, size_t memElems, int (*compar)(const void* a, const void* b))
+	{
+		b = saxnew(path, sizeof(T), memElems, compar);
+		if (b == NULL)
+			throw errno;
+	}
+
+	ExternalArrayBuilder(const ExternalArrayBuilder&) = delete;
+	ExternalArrayBuilder& operator=(const ExternalArrayBuilder&) = delete;
+
+	~ExternalArrayBuilder()
+	{
+		if (b != NULL)
+			saxfinish(b);
+	}
+
+	inline void put(T elem)
+	{
+		saxput(b, &elem);
+		if (errno != 0) throw errno;
+	}
+
+	inline void finish()
+	{
+		saxfinish(b);
+		b = NULL;
+		if (errno != 0) throw errno;
+	}
+
+private:
+	struct sa_xbuilder* b;
+};
+
+/// @see sa_xarray
+template <typename T> class ExternalSortedArray
+{
+public:
+	inline ExternalSortedArray(const char* path, int (*compar)(const void* a, const void* b), size_t blockElems = 0)
+	{
+		x = saxopen(path, sizeof(T), blockElems, compar);
+		if (x == NULL)
+			throw errno;
+	}
+
+	ExternalSortedArray(const ExternalSortedArray&) = delete;
+	ExternalSortedArray& operator=(const ExternalSortedArray&) = delete;
+
+	~ExternalSortedArray()
+	{ saxclose(x); }
+
+	inline T get(size_t index)
+	{
+		alignas(T) unsigned char t[sizeof(T)];
+		saxget(x, index, t);
+		if (errno != 0) throw errno;
+		return *(T*)t;
+	}
+
+	inline void read(size_t from, size_t to, T* out)
+	{
+		saxread(x, from, to, out);
+		if (errno != 0) throw errno;
+	}
+
+	inline size_t find(T elem)
+	{
+		size_t index = saxfind(x, &elem);
+		if (errno != 0) throw errno;
+		return index;
+	}
+
+	inline size_t lower(T elem)
+	{
+		size_t index = saxlower(x, &elem);
+		if (errno != 0) throw errno;
+		return index;
+	}
+
+	inline size_t upper(T elem)
+	{
+		size_t index = saxupper(x, &elem);
+		if (errno != 0) throw errno;
+		return index;
+	}
+
+	inline size_t len()	{ return saxlen(x); }
+
+	inline T operator[](size_t index)
+	{
+		return get(index);
+	}
+
+private:
+	struct sa_xarray* x;
+};
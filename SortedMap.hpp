@@ -0,0 +1,144 @@
+/** @file SortedMap.hpp
+ * Header file for Sorted Map wrapper class.
+ */
+
+#ifndef SORTED_MAP_HPP
+#define SORTED_MAP_HPP
+
+#include "sorted_array.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+
+/**
+ * Sorted map wrapper class
+ *
+ * Keys are ordered by @p Compare, which must be stateless. The default std::less<> is transparent,
+ * so find() and contains() take any type comparable with @p K, and search the dense keys without constructing a @p K.
+ * Keys and values are stored byte-wise, so both must be trivially copyable.
+ * @see sorted_map
+ */
+template <typename K, typename V, typename Compare = std::less<>> class SortedMap
+{
+	static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+		"SortedMap stores keys and values byte-wise");
+	static_assert(std::is_empty<Compare>::value, "SortedMap passes its comparator to the library as a function");
+
+public:
+	inline SortedMap(size_t maxElems)
+	{
+		map = smnew(sizeof(K), sizeof(V), maxElems, compareKeys);
+		if (map == NULL)
+			throw errno;
+	}
+
+	SortedMap(const SortedMap&) = delete;
+	SortedMap& operator=(const SortedMap&) = delete;
+
+	~SortedMap()
+	{ smdelete(map); }
+
+	/// @see smgrowable()
+	inline void setGrowable(bool growable)
+	{
+		smgrowable(map, growable);
+	}
+
+	/// @see smkeytype()
+	inline void setKeyType(enum sa_key_type type)
+	{
+		smkeytype(map, type);
+		if (errno != 0) throw errno;
+	}
+
+	/// Put @p key with @p value, or replace the value of @p key. @see smput()
+	inline void put(const K& key, const V& value)
+	{
+		smput(map, &key, &value);
+		if (errno != 0) throw errno;
+	}
+
+	/// @see smrm()
+	inline void remove(const K& key)
+	{
+		smrm(map, &key);
+		if (errno != 0) throw errno;
+	}
+
+	/**
+	 * Find the value of @p key.
+	 * @return Pointer to the value, valid until the next modification of the map, or NULL if there's no such key.
+	 */
+	template <typename Q>
+	inline V* find(const Q& key)
+	{
+		size_t index = lowerBound(key);
+		if (index == len() || Compare()(key, keys()[index]))
+			return NULL;
+		return values() + index;
+	}
+
+	template <typename Q>
+	inline bool contains(const Q& key)
+	{
+		return find(key) != NULL;
+	}
+
+	/// Get the index of the first key, that is not less than @p key.
+	template <typename Q>
+	inline size_t lowerBound(const Q& key)
+	{
+		return std::lower_bound(keys(), keys() + len(), key, Compare()) - keys();
+	}
+
+	/// Get the value of @p key, putting a value-initialized one first, if there's no such key.
+	V& operator[](const K& key)
+	{
+		V* value = find(key);
+		if (value != NULL)
+			return *value;
+		put(key, V());
+		return *find(key);
+	}
+
+	inline size_t len()	{ return smlen(map); }
+
+	/// Get the key with index @p index.
+	inline const K& key(size_t index)
+	{
+		if (index >= len())
+			throw ERANGE;
+		return keys()[index];
+	}
+
+	/// Get the value of the key with index @p index.
+	inline V& value(size_t index)
+	{
+		if (index >= len())
+			throw ERANGE;
+		return values()[index];
+	}
+
+	/// Get the contiguous buffer of keys, valid until the next modification of the map. @see smkeys()
+	inline const K* keys()	{ return (const K*)smkeys(map); }
+
+	/// Get the contiguous buffer of values, in the order of their keys. @see smvalues()
+	inline V* values()		{ return (V*)smvalues(map); }
+
+private:
+	static int compareKeys(const void* a, const void* b)
+	{
+		const K& x = *(const K*)a;
+		const K& y = *(const K*)b;
+		if (Compare()(x, y))
+			return -1;
+		return Compare()(y, x) ? 1 : 0;
+	}
+
+	struct sorted_map* map;
+};
+
+#endif
@@ -1,10 +1,18 @@
 #include "SortedArray.hpp"
+#include "InlineSortedArray.hpp"
+#include "SortedMap.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 struct Context
 {
@@ -14,6 +22,19 @@ struct Context
 };
 
 int testNumber;
+
+bool equals(struct sorted_array* array, const int* expected, size_t n)
+{
+	if (salen(array) != n)
+		return false;
+
+	for (size_t i = 0; i < n; i++)
+		if (*(int*)saget(array, i) != expected[i])
+			return false;
+
+	return true;
+}
+
 std::ofstream log;
 
 int cmp_int(const void* a, const void* b)
@@ -21,11 +42,27 @@ int cmp_int(const void* a, const void* b)
 	return *(int*)a - *(int*)b;
 }
 
+int cmp_double(const void* a, const void* b)
+{
+	double x = *(double*)a, y = *(double*)b;
+	return (x > y) - (x < y);
+}
+
 void each1(void * p)
 {
 	*(int*)p ^= 0xAAAAAAAA;
 }
 
+void each3(void * p)
+{
+	*(double*)p = -*(double*)p;
+}
+
+void each4(void * p)
+{
+	*(int*)p = -*(int*)p;
+}
+
 void each2(void* p, void * context)
 {
 	log << *(int*) p << ' ';
@@ -35,6 +72,92 @@ void each2(void* p, void * context)
 	ctx->i++;
 }
 
+/// Element, that counts its copies, to check that elements are moved
+struct Heavy
+{
+	static int copies;
+	std::string s;
+
+	Heavy(const char* s) : s(s) {}
+	Heavy(const Heavy& other) : s(other.s) { copies++; }
+	Heavy(Heavy&& other) = default;
+	Heavy& operator=(const Heavy& other) { s = other.s; copies++; return *this; }
+	Heavy& operator=(Heavy&& other) = default;
+	bool operator<(const Heavy& other) const { return s < other.s; }
+};
+
+int Heavy::copies = 0;
+
+/// Element, whose copies fail once a budget runs out, and which has no non-throwing move
+struct Fragile
+{
+	static int budget;
+	static int alive;
+	int v;
+
+	Fragile(int v) : v(v) { alive++; }
+	Fragile(const Fragile& other) : v(other.v) { if (budget-- == 0) throw EIO; alive++; }
+	~Fragile() { alive--; }
+	Fragile& operator=(const Fragile& other) { if (budget-- == 0) throw EIO; v = other.v; return *this; }
+	bool operator<(const Fragile& other) const { return v < other.v; }
+};
+
+int Fragile::budget = -1;
+int Fragile::alive = 0;
+
+/// Value of a sorted map, large enough to spoil the cache if stored with its key
+struct Payload
+{
+	int id;
+	char data[60];
+};
+
+struct Account
+{
+	int id;
+	int branch;
+};
+
+/// Orders accounts by their ids, and compares them with bare ids
+struct ById
+{
+	typedef void is_transparent;
+
+	bool operator()(const Account& a, const Account& b) const { return a.id < b.id; }
+	bool operator()(const Account& a, int id) const { return a.id < id; }
+	bool operator()(int id, const Account& a) const { return id < a.id; }
+};
+
+struct Arena
+{
+	size_t live;
+	size_t allocs;
+	size_t align;
+};
+
+void* arenaAlloc(void* ctx, size_t bytes, size_t align)
+{
+	struct Arena* arena = (struct Arena*) ctx;
+	void* p = aligned_alloc(align, (bytes + align - 1) / align * align);
+	arena->live += bytes;
+	arena->allocs++;
+	arena->align = std::max(arena->align, align);
+	return p;
+}
+
+void* arenaRealloc(void* ctx, void* p, size_t old_bytes, size_t bytes)
+{
+	struct Arena* arena = (struct Arena*) ctx;
+	arena->live += bytes - old_bytes;
+	return realloc(p, bytes);
+}
+
+void arenaFree(void* ctx, void* p, size_t bytes)
+{
+	((struct Arena*) ctx)->live -= bytes;
+	free(p);
+}
+
 
 void testStart()
 {
@@ -291,6 +414,1196 @@ int main()
 			testEnd(false);
 
 		testEnd(true);
+
+	// ---- Test 9 ----
+		testStart();
+
+		SortedArray<int> sb(20, cmp_int);
+		sb.put(5);
+		sb.put(1);
+		sb.put(9);
+
+		int B1[] = {7, 3, 1, 9, 0, 5, 5, 2};
+		sb.put(B1, B1 + 8);
+		log << sb;
+
+		int T7[] = {0, 1, 1, 2, 3, 5, 5, 5, 7, 9, 9};
+		if (sb != T7)
+			testEnd(false);
+
+		try {
+			int B2[10] = {};
+			sb.put(B2, B2 + 10);
+			testEnd(false);
+		} catch (int) { errno = 0; }
+
+		if (sb != T7 || saputn(NULL, B1, 1) != -1)
+			testEnd(false);
+		errno = 0;
+
+		testEnd(true);
+
+	// ---- Test 10 ----
+		testStart();
+
+		SortedArray<int> sg(0, cmp_int);
+		try {
+			sg.put(1);
+			testEnd(false);
+		} catch (int) { errno = 0; }
+
+		sg.setGrowable(true);
+		for (int k = 0; k < 300000; k++)
+			sg.put(k);
+
+		success = sg.len() == 300000;
+		for (int k = 0; k < 300000 && success; k += 1000)
+			success = sg[k] == k;
+
+		sg.removeAll(5);
+		sg.shrink();
+		sg.put(B1, B1 + 8);
+		sg.setGrowable(false);
+		sg.reserve(400000);
+		for (int k = 0; k < 10; k++)
+			sg.put(k);
+
+		success &= sg.len() == 300017 && sg.find(9) == 24 && sg[300016] == 299999;
+		testEnd(success);
+
+	// ---- Test 11 ----
+		testStart();
+
+		InlineSortedArray<int> si(20);
+		try
+		{
+			for (int a : IN)
+				si.put(a);
+			testEnd(false);
+		} catch (int) {}
+		log << si;
+
+		success = si == T1;
+		si.removeAll(3);
+		si.removeAll(6);
+		si.removeAll(0);
+		si.removeAll(9);
+		si.removeAll(10);
+		success &= si == T2;
+		success &= si.find(4) == 4 && si.find(8) == 10;
+
+		try {
+			si.find(6);
+			testEnd(false);
+		} catch (int) {}
+
+		si.remove(0);
+		si.remove(1);
+		si.remove(2);
+		success &= si == T3;
+
+		InlineSortedArray<int, std::greater<int>> sd(0);
+		sd.setGrowable(true);
+		sd.put(B1, B1 + 8);
+		sd.put(4);
+		log << sd;
+
+		int T8[] = {9, 7, 5, 5, 4, 3, 2, 1, 0};
+		success &= sd == T8;
+		testEnd(success);
+
+	// ---- Test 12 ----
+		testStart();
+
+		SortedArray<int> sx(1000, cmp_int);
+		for (int k = 0; k < 999; k++)
+			sx.put(k / 3 * 2);
+		sx.setIndexed(true);
+
+		success = true;
+		for (int round = 0; round < 2 && success; round++)
+		{
+			for (int k = -1; k < 700; k++)
+			{
+				size_t expected = (k >= 0 && k % 2 == 0 && k < 666) ? (size_t)(k / 2 * 3) : (size_t)-1;
+				size_t got;
+				try { got = sx.find(k); } catch (int) { errno = 0; got = (size_t)-1; }
+				if (got != expected)
+				{
+					log << k << ": " << got << " != " << expected << '\n';
+					success = false;
+					break;
+				}
+			}
+			sx.put(-5);
+			sx.remove(0);
+		}
+
+		testEnd(success);
+
+	// ---- Test 13 ----
+		testStart();
+
+		SortedArray<int> sk(3000, cmp_int);
+		SortedArray<double> sf(3000, cmp_double);
+		sk.setKeyType(SA_KEY_INT32);
+		sf.setKeyType(SA_KEY_DOUBLE);
+
+		try {
+			sk.setKeyType(SA_KEY_INT64);
+			testEnd(false);
+		} catch (int) { errno = 0; }
+
+		for (int k = 0; k < 3000; k++)
+		{
+			sk.put(k / 5 * 3);
+			sf.put(k / 5 * 1.5);
+		}
+
+		success = true;
+		for (int k = -2; k < 1802 && success; k++)
+		{
+			size_t expected = (k >= 0 && k % 3 == 0 && k < 1800) ? (size_t)(k / 3 * 5) : (size_t)-1;
+			size_t got, gotf;
+			try { got = sk.find(k); } catch (int) { errno = 0; got = (size_t)-1; }
+			try { gotf = sf.find(k * 0.5); } catch (int) { errno = 0; gotf = (size_t)-1; }
+			if (got != expected || gotf != expected)
+			{
+				log << k << ": " << got << ", " << gotf << " != " << expected << '\n';
+				success = false;
+			}
+		}
+
+		sk.removeAll(897);
+		success &= sk.len() == 2995 && sk[2994] == 1797 && sk.find(900) == 1495;
+		testEnd(success);
+
+	// ---- Test 14 ----
+		testStart();
+
+		SortedArray<int> sr(4000, cmp_int);
+		SortedArray<int> sc(4000, cmp_int);
+		for (int k = 0; k < 100; k++)
+		{
+			sr.put(k % 37);
+			sc.put(k % 37);
+		}
+		sc.setBlocked(8);
+
+		success = true;
+		unsigned seed = 12345;
+		for (int step = 0; step < 6000 && success; step++)
+		{
+			seed = seed * 1103515245 + 12345;
+			int v = (seed >> 8) % 500;
+			if (v % 5 < 3 || sr.len() == 0)
+			{
+				sr.put(v);
+				sc.put(v);
+			}
+			else if (v % 5 == 3)
+			{
+				sr.remove(v % sr.len());
+				sc.remove(v % sc.len());
+			}
+			else
+			{
+				sr.removeAll(sr[v % sr.len()]);
+				sc.removeAll(sc[v % sc.len()]);
+			}
+
+			if (sr.len() != sc.len())
+				success = false;
+			for (size_t k = 0; k < sr.len() && success && step % 100 == 0; k++)
+				success = sr[k] == sc[k];
+		}
+
+		int B3[] = {250, 2, 499, 77};
+		sr.put(B3, B3 + 4);
+		sc.put(B3, B3 + 4);
+		for (int k = 0; k < 500 && success; k++)
+		{
+			size_t a, b;
+			try { a = sr.find(k); } catch (int) { errno = 0; a = (size_t)-1; }
+			try { b = sc.find(k); } catch (int) { errno = 0; b = (size_t)-1; }
+			success = a == b;
+		}
+
+		size_t count = 0;
+		for (SortedArray<int>::Iterator it(sc); !it.isEnd(); it.next())
+			success &= it.get() == sr[count++];
+		success &= count == sr.len();
+
+		sr.foreach(each1);
+		sc.foreach(each1);
+		sr.resort();
+		sc.resort();
+		for (size_t k = 0; k < sr.len() && success; k++)
+			success = sr[k] == sc[k];
+
+		testEnd(success);
+
+	// ---- Test 15 ----
+		testStart();
+
+		SortedArray<int> sw(3000, cmp_int);
+		SortedArray<int> sp(3000, cmp_int);
+		sw.setWriteBuffer(16);
+
+		success = true;
+		for (int step = 0; step < 2000 && success; step++)
+		{
+			seed = seed * 1103515245 + 12345;
+			int v = (seed >> 8) % 300;
+			sw.put(v);
+			sp.put(v);
+
+			size_t a, b;
+			try { a = sp.find(v / 2); } catch (int) { errno = 0; a = (size_t)-1; }
+			try { b = sw.find(v / 2); } catch (int) { errno = 0; b = (size_t)-1; }
+			success = a == b && sw.len() == sp.len() && sw[v % sw.len()] == sp[v % sp.len()];
+			if (step % 300 == 0)
+				sw.remove(0), sp.remove(0);
+		}
+
+		count = 0;
+		for (SortedArray<int>::Iterator it(sw); !it.isEnd(); it.next())
+			success &= it.get() == sp[count++];
+		success &= count == sp.len();
+
+		sw.removeAll(150);
+		sp.removeAll(150);
+		sw.put(150);
+		sp.put(150);
+		sw.flush();
+		for (size_t k = 0; k < sp.len() && success; k++)
+			success = sw.cmp(k, sp[k]) == 0;
+
+		testEnd(success);
+
+	// ---- Test 16 ----
+		testStart();
+
+		SortedArray<int> sq(100, cmp_int);
+		sq.put(T7, T7 + 11);
+		sq.setWriteBuffer(8);
+		sq.put(5);
+		sq.put(-3);
+		log << sq;
+
+		success = sq.lowerBound(5) == 6 && sq.upperBound(5) == 10 && sq.count(5) == 4 && sq.count(4) == 0;
+		success &= sq.lowerBound(-10) == 0 && sq.upperBound(100) == 13 && sq.lowerBound(6) == 10;
+
+		SortedArray<int>::Span span = sq.range(1, 5);
+		int T9[] = {1, 1, 2, 3, 5, 5, 5, 5};
+		success &= span.size() == 8 && std::equal(span.begin(), span.end(), T9);
+		success &= sq.range(6, 6).empty() && sq.range(9, 0).empty() && sq.equalRange(9).size() == 2;
+
+		try {
+			sc.range(0, 1);
+			testEnd(false);
+		} catch (int) { errno = 0; }
+
+		testEnd(success);
+
+	// ---- Test 17 ----
+		testStart();
+
+		SortedArray<int> sn(1000, cmp_int);
+		SortedArray<int> sbn(1000, cmp_int);
+		for (int k = 0; k < 1000; k++)
+			sn.put(k / 2 * 3);
+		sbn.setBlocked(16);
+		sbn.put(T7, T7 + 11);
+
+		success = true;
+		for (int variant = 0; variant < 3 && success; variant++)
+		{
+			SortedArray<int>& target = variant == 2 ? sbn : sn;
+			int keys[300];
+			size_t indices[300];
+			for (int k = 0; k < 300; k++)
+				keys[k] = variant == 0 ? k * 5 - 50 : (k * 7919) % (variant == 1 ? 1600 : 12) - 1;
+
+			size_t found = target.find(keys, 300, indices);
+			size_t expected = 0;
+			for (int k = 0; k < 300 && success; k++)
+			{
+				size_t index;
+				try { index = target.find(keys[k]); expected++; } catch (int) { errno = 0; index = (size_t)-1; }
+				success = index == indices[k];
+			}
+			success &= found == expected && found > 0;
+		}
+
+		testEnd(success);
+
+	// ---- Test 18 ----
+		testStart();
+
+		sbn.put(B1, B1 + 8);
+		sbn.put(B1, B1 + 8);
+		sn.removeIf([](int x) { return x % 2 == 1 || x > 1000; });
+		sbn.removeIf([](int x) { return x % 3 == 0; });
+		log << sbn;
+
+		success = sn.len() == 334 && sn[0] == 0 && sn[333] == 996 && sn.count(6) == 2;
+		int T10[] = {1, 1, 1, 1, 2, 2, 2, 5, 5, 5, 5, 5, 5, 5, 7, 7, 7};
+		success &= sbn == T10;
+
+		SortedArray<int> scnt(10, cmp_int);
+		for (int k = 0; k < 10; k++)
+			scnt.put(k);
+		size_t calls = 0;
+		scnt.removeIf([&calls](int x) { calls++; return x % 2 == 0; });
+		int T10odd[] = {1, 3, 5, 7, 9};
+		success &= calls == 10 && scnt == T10odd;
+		int firstK = 2;
+		scnt.removeIf([&firstK](int) { return firstK-- > 0; });
+		int T10tail[] = {5, 7, 9};
+		success &= scnt == T10tail;
+
+		sn.removeRange(2, 332);
+		sbn.removeRange(0, 4);
+		sbn.removeRange(5, 13);
+		int T11[] = {0, 0, 996, 996};
+		int T12[] = {2, 2, 2, 5, 5};
+		success &= sn == T11 && sbn == T12;
+
+		try {
+			sn.removeRange(3, 5);
+			testEnd(false);
+		} catch (int) { errno = 0; }
+
+		testEnd(success);
+
+	// ---- Test 19 ----
+		testStart();
+
+		struct sorted_array* sa1 = sanew(sizeof(int), 20, cmp_int);
+		struct sorted_array* sa2 = sanew(sizeof(int), 20, cmp_int);
+		struct sorted_array* sa3 = sanew(sizeof(int), 2, cmp_int);
+		int S1[] = {1, 2, 2, 2, 4, 6, 8, 8};
+		int S2[] = {2, 2, 3, 4, 8, 9};
+		saputn(sa1, S1, 8);
+		saputn(sa2, S2, 6);
+
+		int U[] = {1, 2, 2, 2, 3, 4, 6, 8, 8, 9};
+		int I[] = {2, 2, 4, 8};
+		int D[] = {1, 2, 6, 8};
+		int X[] = {1, 2, 3, 6, 8, 9};
+
+		success = saunion(sa3, sa1, sa2) == -1 && errno == ENOBUFS;
+		errno = 0;
+		sagrowable(sa3, 1);
+		success &= saunion(sa3, sa1, sa2) == 0 && equals(sa3, U, 10);
+		success &= saintersect(sa3, sa1, sa2) == 0 && equals(sa3, I, 4);
+		success &= sadiff(sa3, sa1, sa2) == 0 && equals(sa3, D, 4);
+		success &= sasymdiff(sa3, sa1, sa2) == 0 && equals(sa3, X, 6);
+		success &= saintersectcount(sa1, sa2) == 4 && saintersectcount(sa2, sa3) == 4;
+		success &= saunion(sa1, sa1, sa2) == -1 && errno == EINVAL;
+		errno = 0;
+
+		sarmrange(sa1, 0, 8);
+		sagrowable(sa1, 1);
+		sakeytype(sa1, SA_KEY_INT32);
+		for (int k = 0; k < 5000; k++)
+			saput(sa1, &k);
+		int S3[] = {-1, 0, 100, 4095, 4999, 6000};
+		sarmrange(sa2, 0, 6);
+		saputn(sa2, S3, 6);
+		int I2[] = {0, 100, 4095, 4999};
+		success &= saintersect(sa3, sa1, sa2) == 0 && equals(sa3, I2, 4) && saintersectcount(sa2, sa1) == 4;
+		success &= sadiff(sa3, sa2, sa1) == 0 && salen(sa3) == 2 && sasymdiff(sa3, sa1, sa2) == 0 && salen(sa3) == 4998;
+
+		sagrowable(sa2, 1);
+		for (int k = 0; k < 1000; k += 10)
+			saput(sa2, &k);
+		success &= saintersectcount(sa1, sa2) == 102 && saintersectcount(sa2, sa1) == 102;
+
+		sadelete(sa1);
+		sadelete(sa2);
+		sadelete(sa3);
+		testEnd(success);
+
+	// ---- Test 20 ----
+		testStart();
+
+		SortedArray<int> m1(10, cmp_int), m2(10, cmp_int), m3(10, cmp_int), mall(5, cmp_int);
+		m1.put(T2, T2 + 5);
+		m3.put(S2, S2 + 6);
+		m3.setBlocked(4);
+		m1.setWriteBuffer(4);
+		m1.put(3);
+		SortedArray<int>* shards[] = {&m1, &m2, &m3, &sq};
+
+		int T13[] = {-3, 0, 1, 1, 1, 1, 2, 2, 2, 2, 2, 3, 3, 3, 4, 4, 5, 5, 5, 5, 7, 8, 9, 9, 9};
+		i = 0;
+		success = true;
+		for (SortedArray<int>::MergeIterator it(shards, 4); !it.isEnd(); it.next())
+		{
+			log << it.get() << ' ';
+			success &= it.get() == T13[i++];
+		}
+		log << '\n';
+		success &= i == 25;
+
+		try {
+			mall.merge(shards, 4);
+			testEnd(false);
+		} catch (int) { errno = 0; }
+
+		mall.setGrowable(true);
+		mall.merge(shards, 4);
+		log << mall;
+		success &= mall == T13;
+
+		testEnd(success);
+
+	// ---- Test 21 ----
+		testStart();
+
+		SortedArray<int> sl(0, cmp_int);
+		SortedArray<int> sli(0, cmp_int);
+		SortedArray<double> sld(0, cmp_double);
+		sl.setGrowable(true);
+		sli.setGrowable(true);
+		sld.setGrowable(true);
+		sl.setThreads(4);
+		sli.setKeyType(SA_KEY_INT32);
+		sld.setKeyType(SA_KEY_DOUBLE);
+		for (int k = 0; k < 100000; k++)
+		{
+			seed = seed * 1103515245 + 12345;
+			int v = (int)(seed >> 4) - (1 << 27);
+			sl.put(v);
+			sli.put(v);
+			sld.put(v * 0.25);
+		}
+
+		sl.foreach(each4);
+		sli.foreach(each4);
+		sld.foreach(each3);
+		sl.resort();
+		sli.resort();
+		sld.resort();
+
+		success = sl.len() == 100000;
+		for (size_t k = 0; k < sl.len() && success; k++)
+			success = sl[k] == sli[k] && (k == 0 || (sl[k - 1] <= sl[k] && sld[k - 1] <= sld[k]));
+
+		testEnd(success);
+
+	// ---- Test 22 ----
+		testStart();
+
+		struct sorted_array* st = sanew(sizeof(int), 20001, cmp_int);
+		int* ref = new int[20000];
+		for (int k = 0; k < 20000; k++)
+			saput(st, &(ref[k] = k * 2));
+
+		for (int k = 0; k < 50; k++)
+		{
+			seed = seed * 1103515245 + 12345;
+			size_t at = (seed >> 8) % 20000;
+			*(int*)saget(st, at) = ref[at] = (int)(seed >> 12) % 50000 - 5000;
+			satouch(st, at);
+		}
+		for (int k = 100; k < 110; k++)
+			*(int*)saget(st, k) = ref[k] = -k;
+		satouchrange(st, 100, 110);
+		success = saresort(st) == 0;
+		qsort(ref, 20000, sizeof(int), cmp_int);
+		success &= equals(st, ref, 20000);
+
+		*(int*)saget(st, 7) = ref[7] = 1 << 20;
+		satouch(st, 7);
+		int big = 1 << 21;
+		saput(st, &big);
+		success &= saresort(st) == 0 && *(int*)saget(st, 20001 - 2) == 1 << 20;
+		success &= satouch(st, 20001) == -1 && errno == ERANGE;
+		errno = 0;
+		success &= satouchrange(st, 5, 3) == -1 && errno == ERANGE;
+		errno = 0;
+
+		sablocks(st, 256);
+		for (int k = 0; k < 20001; k++)
+			*(int*)saget(st, k) = 20001 - k;
+		success &= saresort(st) == 0 && *(int*)saget(st, 0) == 1 && *(int*)saget(st, 20000) == 20001;
+		*(int*)saget(st, 300) = 0;
+		satouch(st, 300);
+		success &= saresort(st) == 0 && *(int*)saget(st, 0) == 0 && *(int*)saget(st, 1) == 1 && *(int*)saget(st, 300) == 300;
+
+		delete[] ref;
+		sadelete(st);
+
+		testEnd(success);
+
+	// ---- Test 23 ----
+		testStart();
+
+		SortedArray<int> sv(16, cmp_int);
+		sv.setGrowable(true);
+		for (int k = 0; k < 2000; k += 2)
+			sv.put(k);
+		sv.setConcurrent(true);
+
+		bool readers_ok = true;
+		bool writing = true;
+		std::vector<std::thread> readers;
+		for (int r = 0; r < 4; r++)
+			readers.emplace_back([&sv, &readers_ok, &writing, r]()
+			{
+				for (int k = r * 2; __atomic_load_n(&writing, __ATOMIC_ACQUIRE); k = (k + 8) % 2000)
+				{
+					size_t at = sv.find(k);
+					int v[2];
+					sv.read(0, 2, v);
+					if (sv.count(k) != 1 || at < (size_t)k / 2 || at > (size_t)k || v[0] != 0 || v[1] > 2)
+						__atomic_store_n(&readers_ok, false, __ATOMIC_RELAXED);
+				}
+			});
+
+		for (int round = 0; round < 20; round++)
+		{
+			for (int k = 1; k < 2000; k += 2)
+				sv.put(k);
+			for (int k = 1; k < 2000; k += 2)
+				sv.removeAll(k);
+		}
+		__atomic_store_n(&writing, false, __ATOMIC_RELEASE);
+		for (std::thread& t : readers)
+			t.join();
+
+		success = readers_ok && sv.len() == 1000;
+		try
+		{
+			sv.shrink();
+			testEnd(false);
+		} catch (int err) { success &= err == EOPNOTSUPP; errno = 0; }
+		try
+		{
+			sv.setIndexed(true);
+			testEnd(false);
+		} catch (int err) { success &= err == EINVAL; errno = 0; }
+		sv.setConcurrent(false);
+		sv.shrink();
+		success &= sv.len() == 1000 && sv[999] == 1998;
+
+		testEnd(success);
+
+	// ---- Test 24 ----
+		testStart();
+
+		ShardedArray<int> sh(512, cmp_int);
+		std::vector<std::thread> writers;
+		for (int w = 0; w < 4; w++)
+			writers.emplace_back([&sh, w]()
+			{
+				errno = 0;
+				for (int k = 0; k < 5000; k++)
+					sh.put(w * 100000 + (k * 7919) % 5000);
+			});
+		for (std::thread& t : writers)
+			t.join();
+
+		success = sh.len() == 20000 && sh.shards() >= 40 && sh[0] == 0 && sh[19999] == 304999;
+		for (size_t k = 1; k < 20000 && success; k++)
+			success = sh[k - 1] < sh[k];
+		success &= sh.find(200000) == 10000 && sh.find(104999) == 9999;
+		try
+		{
+			sh.find(5000);
+			testEnd(false);
+		} catch (int err) { success &= err == ENOENT; errno = 0; }
+
+		size_t before = sh.shards();
+		for (int k = 100000; k < 105000; k++)
+			sh.removeAll(k);
+		success &= sh.len() == 15000 && sh.shards() < before && sh[5000] == 200000 && sh.find(200000) == 5000;
+
+		testEnd(success);
+
+	// ---- Test 25 ----
+		testStart();
+
+		SortedArray<int> so(0, cmp_int);
+		so.setGrowable(true);
+		so.setBlocked(64);
+		for (int k = 0; k < 10000; k++)
+			so.put(k * 2);
+
+		SortedArray<int>* snap = so.snapshot();
+		bool scan_ok = true;
+		std::thread scanner([snap, &scan_ok]()
+		{
+			errno = 0;
+			for (int pass = 0; pass < 5; pass++)
+			{
+				int expected = 0;
+				for (SortedArray<int>::Iterator it(*snap); !it.isEnd(); it.next(), expected += 2)
+					scan_ok &= it.get() == expected;
+				scan_ok &= expected == 20000;
+			}
+		});
+		for (int k = 0; k < 5000; k++)
+			so.put(k * 4 + 1);
+		so.removeRange(100, 200);
+		scanner.join();
+
+		success = scan_ok && snap->len() == 10000 && so.len() == 14900 && so[1] == 1;
+		snap->remove(0);
+		snap->put(-5);
+		success &= (*snap)[0] == -5 && (*snap)[1] == 2 && so[0] == 0;
+		delete snap;
+		success &= so.len() == 14900 && so[14899] == 19998;
+
+		try
+		{
+			delete sv.snapshot();
+			testEnd(false);
+		} catch (int err) { success &= err == EOPNOTSUPP; errno = 0; }
+
+		testEnd(success);
+
+	// ---- Test 26 ----
+		testStart();
+
+		remove("Tests.sa");
+		errno = 0;
+		SortedArray<int>* sm = SortedArray<int>::open("Tests.sa", SA_OPEN_WRITE | SA_OPEN_CREATE, 100, cmp_int);
+		sm->setGrowable(true);
+		for (int k = 999; k >= 0; k--)
+			sm->put(k);
+		sm->removeAll(500);
+		sm->sync();
+		delete sm;
+
+		sm = SortedArray<int>::open("Tests.sa", SA_OPEN_READ, 0, cmp_int);
+		SortedArray<int>* sm2 = SortedArray<int>::open("Tests.sa", SA_OPEN_READ, 0, cmp_int);
+		success = sm->len() == 999 && sm->find(501) == 500 && (*sm2)[998] == 999 && sm2->count(500) == 0;
+		try
+		{
+			sm->sync();
+			testEnd(false);
+		} catch (int err) { success &= err == EROFS; errno = 0; }
+		sm->put(500);
+		success &= sm->len() == 1000 && sm2->len() == 999 && (*sm2)[500] == 501;
+		delete sm;
+		delete sm2;
+
+		success &= saopen("Tests.sa", sizeof(double), 0, cmp_double, SA_OPEN_READ) == NULL && errno == EINVAL;
+		errno = 0;
+		success &= saopen("Tests.sa", sizeof(int), 0, cmp_int, SA_OPEN_CREATE) == NULL && errno == EINVAL;
+		errno = 0;
+		success &= saopen("Tests.missing", sizeof(int), 0, cmp_int, SA_OPEN_READ) == NULL && errno == ENOENT;
+		errno = 0;
+		FILE* junk = fopen("Tests.sa", "w");
+		fputs("not a sorted array, but long enough to hold a header of one", junk);
+		fclose(junk);
+		success &= saopen("Tests.sa", sizeof(int), 0, cmp_int, SA_OPEN_READ) == NULL && errno == EPROTO;
+		errno = 0;
+		remove("Tests.sa");
+
+		testEnd(success);
+
+	// ---- Test 27 ----
+		testStart();
+
+		FILE* tf = tmpfile();
+		SortedArray<int> se(0, cmp_int);
+		se.setGrowable(true);
+		for (int k = 0; k < 50000; k++)
+			se.put((k * 7919) % 50000);
+		se.save(tf);
+		rewind(tf);
+		SortedArray<int>* sload = SortedArray<int>::load(tf, cmp_int);
+		success = sload->len() == 50000 && (*sload)[0] == 0 && (*sload)[49999] == 49999 && sload->find(31337) == 31337;
+		delete sload;
+
+		long tsize = ftell(tf);
+		char* image = (char*) malloc(tsize);
+		rewind(tf);
+		success &= fread(image, 1, tsize, tf) == (size_t)tsize;
+		fclose(tf);
+		struct sorted_array* sz = saloadmem(image, tsize, cmp_int);
+		success &= sz != NULL && sadata(sz) == image + 48 && salen(sz) == 50000 && *(int*)saget(sz, 123) == 123;
+		sagrowable(sz, 1);
+		int bigger = 50000;
+		saput(sz, &bigger);
+		success &= sadata(sz) != image + 48 && salen(sz) == 50001 && *(int*)saget(sz, 50000) == 50000;
+		sadelete(sz);
+
+		char* pristine = (char*) malloc(tsize);
+		memcpy(pristine, image, tsize);
+		sz = saloadmem(image, tsize, cmp_int);
+		success &= sz != NULL && sadata(sz) == image + 48 && sarm(sz, 0) == 0 && sadata(sz) != image + 48 && 
+			sarmrange(sz, 100, 200) == 0 && salen(sz) == 49899 && *(int*)saget(sz, 0) == 1 && *(int*)saget(sz, 100) == 201;
+		sadelete(sz);
+		sz = saloadmem(image, tsize, cmp_int);
+		success &= sz != NULL && saforeach(sz, each4) == 0 && memcmp(image, pristine, tsize) == 0;
+		sadelete(sz);
+		sz = saloadmem(image, tsize, cmp_int);
+		success &= sz != NULL && salen(sz) == 50000 && *(int*)saget(sz, 0) == 0;
+		sadelete(sz);
+		free(pristine);
+
+		image[tsize / 2] ^= 1;
+		success &= saloadmem(image, tsize, cmp_int) == NULL && errno == EBADMSG;
+		errno = 0;
+		success &= saloadmem(image, 40, cmp_int) == NULL && errno == EBADMSG;
+		errno = 0;
+		free(image);
+
+		struct sorted_array* sbl = sanew(sizeof(int), 0, cmp_int);
+		sagrowable(sbl, 1);
+		for (int k = 999; k >= 0; k--)
+			saput(sbl, &k);
+		sablocks(sbl, 64);
+		tf = tmpfile();
+		sasave(sbl, tf);
+		tsize = ftell(tf);
+		image = (char*) malloc(tsize);
+		rewind(tf);
+		success &= fread(image, 1, tsize, tf) == (size_t)tsize;
+		fclose(tf);
+		sz = saloadmem(image, tsize, cmp_int);
+		success &= sz != NULL && sadata(sz) != image + 48 && salen(sz) == 1000 &&
+			*(int*)saget(sz, 777) == 777;
+		sadelete(sz);
+		free(image);
+		sadelete(sbl);
+
+		// A forged element count must be rejected before it is allocated
+		struct sorted_array* sforge = sanew(sizeof(int), 10, cmp_int);
+		for (int k = 0; k < 10; k++)
+			saput(sforge, &k);
+		tf = tmpfile();
+		sasave(sforge, tf);
+		tsize = ftell(tf);
+		uint64_t forged = (uint64_t)1 << 40;
+		fseek(tf, 24, SEEK_SET);
+		fwrite(&forged, sizeof(forged), 1, tf);
+		rewind(tf);
+		success &= saload(tf, cmp_int) == NULL && errno == EBADMSG;
+		errno = 0;
+		image = (char*) malloc(tsize);
+		rewind(tf);
+		success &= fread(image, 1, tsize, tf) == (size_t)tsize;
+		fclose(tf);
+		int ffds[2];
+		success &= pipe(ffds) == 0 && write(ffds[1], image, tsize) == tsize;
+		close(ffds[1]);
+		FILE* fpin = fdopen(ffds[0], "r");
+		success &= saload(fpin, cmp_int) == NULL && errno == EBADMSG;
+		errno = 0;
+		fclose(fpin);
+		free(image);
+		sadelete(sforge);
+
+		int fds[2];
+		success &= pipe(fds) == 0;
+		FILE* pin = fdopen(fds[0], "r");
+		FILE* pout = fdopen(fds[1], "w");
+		std::thread exporter([pout]()
+		{
+			struct sa_writer* w = sawropen(pout, sizeof(int));
+			for (int k = 0; k < 100000; k += 100)
+			{
+				int part[100];
+				for (int m = 0; m < 100; m++)
+					part[m] = k + m;
+				sawrput(w, part, 100);
+			}
+			sawrclose(w);
+			fclose(pout);
+		});
+		struct sa_reader* r = sardopen(pin, sizeof(int));
+		int piece[333];
+		size_t got;
+		size_t total = 0;
+		bool ordered = true;
+		while ((got = sardnext(r, piece, 333)) != 0 && got != (size_t)-1)
+			for (size_t m = 0; m < got; m++)
+				ordered &= piece[m] == (int)(total++);
+		sardclose(r);
+		exporter.join();
+		fclose(pin);
+		success &= got == 0 && ordered && total == 100000;
+
+		tf = tmpfile();
+		struct sa_writer* w = sawropen(tf, sizeof(int));
+		int odd[] = {5, 3, 9, 1};
+		sawrput(w, odd, 4);
+		sawrclose(w);
+		rewind(tf);
+		success &= sardopen(tf, sizeof(double)) == NULL && errno == EINVAL;
+		errno = 0;
+		rewind(tf);
+		sz = saload(tf, cmp_int);
+		int sorted_odd[] = {1, 3, 5, 9};
+		success &= sz != NULL && equals(sz, sorted_odd, 4);
+		sadelete(sz);
+		fclose(tf);
+
+		testEnd(success);
+
+	// ---- Test 28 ----
+		testStart();
+
+		ExternalArrayBuilder<int>* xb = new ExternalArrayBuilder<int>("Tests.sax", 1000, cmp_int);
+		for (int k = 0; k < 200000; k++)
+			xb->put((k * 7919) % 100000);
+		xb->finish();
+		delete xb;
+
+		ExternalSortedArray<int>* xa = new ExternalSortedArray<int>("Tests.sax", cmp_int, 128);
+		success = xa->len() == 200000 && (*xa)[0] == 0 && (*xa)[1] == 0 && (*xa)[199999] == 99999;
+		for (int k = 0; k < 100000; k += 997)
+			success &= xa->find(k) == (size_t)2 * k && xa->lower(k) == (size_t)2 * k && xa->upper(k) == (size_t)2 * k + 2;
+		success &= xa->lower(-5) == 0 && xa->upper(100000) == 200000;
+		int xs[300];
+		xa->read(1000, 1300, xs);
+		for (int k = 0; k < 300; k++)
+			success &= xs[k] == (1000 + k) / 2;
+		try
+		{
+			xa->find(100000);
+			testEnd(false);
+		} catch (int err) { success &= err == ENOENT; errno = 0; }
+		delete xa;
+
+		SortedArray<int>* xm = SortedArray<int>::open("Tests.sax", SA_OPEN_READ, 0, cmp_int);
+		success &= xm->len() == 200000 && xm->find(31337) == 62674;
+		delete xm;
+
+		xb = new ExternalArrayBuilder<int>("Tests.sax", 16, cmp_int);
+		int few[] = {3, 1, 2};
+		for (int k = 0; k < 3; k++)
+			xb->put(few[k]);
+		delete xb;
+		struct sa_xarray* xr = saxopen("Tests.sax", sizeof(int), 0, cmp_int);
+		size_t xbegin, xend;
+		int lo = 2, hi = 5;
+		success &= xr != NULL && saxlen(xr) == 3 && saxrange(xr, &lo, &hi, &xbegin, &xend) == 0 && xbegin == 1 && xend == 3;
+		saxclose(xr);
+
+		success &= saxopen("Tests.sax", sizeof(double), 0, cmp_double) == NULL && errno == EINVAL;
+		errno = 0;
+		success &= saxopen("Tests.missing", sizeof(int), 0, cmp_int) == NULL && errno == ENOENT;
+		errno = 0;
+		success &= saxnew("Tests.sax", sizeof(int), 1, cmp_int) == NULL && errno == EINVAL;
+		errno = 0;
+		remove("Tests.sax");
+		errno = 0;
+
+		testEnd(success);
+
+	// ---- Test 29 ----
+		testStart();
+
+		struct Arena arena = { 0, 0, 0 };
+		struct sa_allocator arenaAllocator = { arenaAlloc, NULL, arenaFree, &arena };
+		SortedArray<int>* sal = new SortedArray<int>(10, cmp_int, &arenaAllocator, SA_ALLOC_ALIGNED);
+		sal->setGrowable(true);
+		for (int k = 0; k < 100000; k++)
+			sal->put(-k);
+		success = sal->len() == 100000 && (*sal)[0] == -99999 && arena.align == 64;
+		size_t allocs = arena.allocs;
+		for (SortedArray<int>::Iterator it(*sal); !it.isEnd(); it.next())
+			;
+		success &= arena.allocs == allocs + 1;
+		delete sal;
+		success &= arena.live == 0;
+
+		arenaAllocator.realloc = arenaRealloc;
+		struct sorted_array* sar = sanew_ex(sizeof(int), 1, cmp_int, &arenaAllocator, 0);
+		sagrowable(sar, 1);
+		for (int k = 0; k < 1000; k++)
+			saput(sar, &k);
+		success &= salen(sar) == 1000 && *(int*)saget(sar, 999) == 999 && arena.live > 0;
+		sadelete(sar);
+		success &= arena.live == 0;
+
+		struct sorted_array* sah = sanew_ex(sizeof(int), 1 << 20, cmp_int, NULL, SA_ALLOC_HUGETLB | SA_ALLOC_ALIGNED);
+		sagrowable(sah, 1);
+		for (int k = 0; k < (3 << 19); k++)
+			saput(sah, &k);
+		success &= sah != NULL && salen(sah) == (3 << 19) && *(int*)saget(sah, 12345) == 12345 && 
+			(size_t)sadata(sah) % 64 == 0;
+		sadelete(sah);
+
+		success &= sanew_ex(sizeof(int), 10, cmp_int, &arenaAllocator, SA_ALLOC_HUGEPAGES) == NULL && errno == EINVAL;
+		errno = 0;
+		success &= sanew_ex(sizeof(int), 10, cmp_int, NULL, 8) == NULL && errno == EINVAL;
+		errno = 0;
+
+		testEnd(success);
+
+	// ---- Test 30 ----
+		testStart();
+
+		static_assert(std::is_same<std::iterator_traits<SortedArray<int>::iterator>::iterator_category, 
+			std::random_access_iterator_tag>::value, "SortedArray iterators are random access");
+
+		SortedArray<int> sti(1000, cmp_int);
+		for (int k = 999; k >= 0; k--)
+			sti.put(k / 2);
+		long sum = 0;
+		for (const int& x : sti)
+			sum += x;
+		success = sum == 249500 && std::is_sorted(sti.begin(), sti.end()) && sti.size() == 1000 && !sti.empty();
+		success &= (size_t)(std::lower_bound(sti.begin(), sti.end(), 123) - sti.begin()) == sti.lowerBound(123);
+		success &= (size_t)(std::upper_bound(sti.begin(), sti.end(), 123) - sti.begin()) == sti.upperBound(123);
+		success &= *sti.rbegin() == 499 && sti.rend() - sti.rbegin() == 1000 && &sti.front() == sti.data() && sti.back() == 499;
+		int evens = 0;
+		std::for_each(sti.cbegin(), sti.cend(), [&evens](const int& x) { evens += x % 2 == 0; });
+		success &= evens == 500;
+
+		sti.removeAll(0);
+		sti.setBlocked(64);
+		try
+		{
+			sti.begin();
+			testEnd(false);
+		} catch (int err) { success &= err == EOPNOTSUPP; errno = 0; }
+
+		testEnd(success);
+
+	// ---- Test 31 ----
+		testStart();
+
+		SortedArray<int> su(0, cmp_int);
+		su.setGrowable(true);
+		for (int k = 0; k < 1000; k++)
+			su.put(k * 2);
+		errno = 0;
+		long usum = 0;
+		for (size_t k = 0; k < su.len(); k++)
+			usum += su.getUnchecked(k);
+		success = usum == 999000 && su.tryFind(500) == (size_t)250 && !su.tryFind(501) && 
+			su.contains(1998) && !su.contains(-2) && su.tryGet(999) == 1998 && !su.tryGet(1000) && errno == 0;
+		int ukey = 40;
+		struct sorted_array* suc = sanew(sizeof(int), 4, cmp_int);
+		saput(suc, &ukey);
+		success &= su.getUnchecked(20) == ukey && sacmp_unchecked(suc, 0, &ukey) == 0 && 
+			safind_unchecked(suc, &ukey) == 0 && *(int*)saget_unchecked(suc, 0) == 40 && errno == 0;
+		sadelete(suc);
+
+		su.setWriteBuffer(16);
+		su.put(501);
+		su.put(-1);
+		success &= su.tryFind(501) == (size_t)252 && su.getUnchecked(0) == -1 && su.tryFind(-1) == (size_t)0 && 
+			!su.tryFind(3) && errno == 0;
+		su.setWriteBuffer(0);
+		su.setBlocked(64);
+		success &= su.tryFind(1998) == (size_t)1001 && su.getUnchecked(1001) == 1998 && !su.tryFind(7) && errno == 0;
+
+		SortedArray<int> suv(16, cmp_int);
+		suv.setGrowable(true);
+		for (int k = 99; k >= 0; k--)
+			suv.put(k);
+		suv.setConcurrent(true);
+		success &= suv.tryGet(42) == 42 && !suv.tryGet(100) && suv.contains(99) && !suv.contains(100) && 
+			suv.tryFind(7) == (size_t)7 && errno == 0;
+
+		testEnd(success);
+
+	// ---- Test 32 ----
+		testStart();
+
+		InlineSortedArray<Heavy> shv(0);
+		shv.setGrowable(true);
+		char name[32];
+		for (int k = 999; k >= 0; k--)
+		{
+			sprintf(name, "a fairly long key number %03d", k);
+			shv.emplace(name);
+		}
+		Heavy middle("a fairly long key number 500 and a half");
+		shv.put(std::move(middle));
+		shv.remove(0);
+		shv.removeAll(Heavy("a fairly long key number 998"));
+		shv.shrink();
+		success = shv.len() == 999 && Heavy::copies == 0 && shv[0].s == "a fairly long key number 001" && 
+			shv[500].s == "a fairly long key number 500 and a half" && shv[998].s == "a fairly long key number 999";
+
+		std::vector<Heavy> more = { "b", "a", "zz" };
+		shv.put(more.begin(), more.end());
+		success &= shv.len() == 1002 && shv[0].s == "a" && shv[1001].s == "zz" && shv.find(Heavy("b")) == 1000;
+
+		// Whichever copy fails, the batch put leaves the array as it was
+		std::vector<Fragile> fragileOdd = { 1, 3, 5 };
+		for (int fail = 0; fail < 40; fail++)
+		{
+			InlineSortedArray<Fragile> sfr(16);
+			for (int k = 0; k < 20; k += 2)
+				sfr.put(Fragile(k));
+			int before = Fragile::alive;
+			Fragile::budget = fail;
+			bool thrown = false;
+			try { sfr.put(fragileOdd.begin(), fragileOdd.end()); } catch (int err) { thrown = err == EIO; }
+			Fragile::budget = -1;
+			if (thrown)
+			{
+				success &= sfr.len() == 10 && Fragile::alive == before;
+				for (size_t k = 0; k < 10; k++)
+					success &= sfr[k].v == (int)k * 2;
+			}
+			else
+				success &= sfr.len() == 13 && sfr[1].v == 1 && sfr[5].v == 5 && sfr[6].v == 6;
+		}
+		success &= Fragile::alive == 3;
+
+		auto derefLess = [](const std::unique_ptr<int>& a, const std::unique_ptr<int>& b) { return *a < *b; };
+		InlineSortedArray<std::unique_ptr<int>, decltype(derefLess)> sup(2, derefLess);
+		sup.setGrowable(true);
+		for (int k = 0; k < 100; k++)
+			sup.emplace(new int((k * 37) % 100));
+		sup.remove(50);
+		InlineSortedArray<std::unique_ptr<int>, decltype(derefLess)> moved(std::move(sup));
+		success &= moved.len() == 99 && *moved[0] == 0 && *moved[50] == 51 && sup.len() == 0;
+
+		testEnd(success);
+
+	// ---- Test 33 ----
+		testStart();
+
+		struct sorted_map* smc = smnew(sizeof(int), sizeof(struct Payload), 0, cmp_int);
+		smgrowable(smc, 1);
+		smkeytype(smc, SA_KEY_INT32);
+		for (int k = 0; k < 1000; k++)
+		{
+			int key = (k * 7919) % 1000;
+			struct Payload pl = { key, {0} };
+			smput(smc, &key, &pl);
+		}
+		int mkey = 500;
+		struct Payload updated = { -500, {0} };
+		smput(smc, &mkey, &updated);
+		success = smlen(smc) == 1000 && ((struct Payload*)smfind(smc, &mkey))->id == -500;
+		mkey = 501;
+		success &= ((struct Payload*)smfind(smc, &mkey))->id == 501 && smrm(smc, &mkey) == 0 && smfind(smc, &mkey) == NULL && 
+			errno == ENOENT && smlower(smc, &mkey) == 501 && *(int*)smkey(smc, 501) == 502 && 
+			((struct Payload*)smvalue(smc, 501))->id == 502 && smlen(smc) == 999;
+		errno = 0;
+		success &= smrm(smc, &mkey) == -1 && errno == ENOENT;
+		errno = 0;
+		for (int k = 0; k < 999; k++)
+			success &= ((struct Payload*)smvalues(smc))[k].id == (k == 500 ? -500 : ((int*)smkeys(smc))[k]);
+		smdelete(smc);
+
+		SortedMap<int, Payload> smp(16);
+		smp.setGrowable(true);
+		for (int k = 99; k >= 0; k--)
+			smp.put(k * 2, Payload { k, {0} });
+		smp[7].id = 77;
+		success &= smp.len() == 101 && smp.find(42)->id == 21 && smp.find((long)42)->id == 21 && smp.find(43) == NULL && 
+			smp.find(7)->id == 77 && smp.key(4) == 7 && smp.lowerBound(8) == 5;
+		smp.remove(42);
+		success &= !smp.contains(42) && smp.contains(44) && errno == 0;
+
+		SortedMap<Account, Payload, ById> sma(0);
+		sma.setGrowable(true);
+		for (int k = 0; k < 50; k++)
+			sma.put(Account { 49 - k, k % 3 }, Payload { k, {0} });
+		success &= sma.find(10) != NULL && sma.find(10)->id == 39 && sma.key(10).branch == 39 % 3 && sma.find(50) == NULL;
+
+		testEnd(success);
+	// ---- Test 34 ----
+		testStart();
+
+		struct sorted_array* scow = sanew(sizeof(int), 0, cmp_int);
+		sagrowable(scow, 1);
+		for (int k = 0; k < 84; k++)
+			saput(scow, &k);
+		sablocks(scow, 16);
+		sarmrange(scow, 24, 33);
+		sarmrange(scow, 51, 61);
+		sarmrange(scow, 28, 51);
+		struct sorted_array* scows = sasnapshot(scow);
+		int cowExpect[84];
+		size_t cowLen = salen(scows);
+		for (size_t k = 0; k < cowLen; k++)
+			cowExpect[k] = *(int*)saget(scows, k);
+		success = sarmrange(scow, 0, 12) == 0 && salen(scow) == cowLen - 12 && salen(scows) == cowLen;
+		for (size_t k = 0; k < cowLen; k++)
+			success &= *(int*)saget(scows, k) == cowExpect[k];
+		for (size_t k = 0; k + 12 < cowLen; k++)
+			success &= *(int*)saget(scow, k) == cowExpect[k + 12];
+
+		FILE* cowf = tmpfile();
+		success &= sasave(scows, cowf) == 0;
+		rewind(cowf);
+		struct sorted_array* scowl = saload(cowf, cmp_int);
+		fclose(cowf);
+		success &= scowl != NULL && salen(scowl) == cowLen && *(int*)saget(scowl, cowLen - 1) == cowExpect[cowLen - 1];
+		sadelete(scowl);
+		sadelete(scows);
+		sadelete(scow);
+
+		testEnd(success);
+	// ---- Test 35 ----
+		testStart();
+
+		struct sorted_array* sovf = sanew(sizeof(int), 4, cmp_int);
+		for (int k = 0; k < 3; k++)
+			saput(sovf, &k);
+		success = sareserve(sovf, (size_t)1 << 62) == -1 && errno == ENOMEM;
+		errno = 0;
+		success &= sanew(sizeof(int), (ssize_t)1 << 62, cmp_int) == NULL && errno == ENOMEM;
+		errno = 0;
+		int ovfElem = 3;
+		success &= saput(sovf, &ovfElem) == 0 && salen(sovf) == 4 && *(int*)saget(sovf, 3) == 3 && 
+			sareserve(sovf, 64) == 0;
+		sadelete(sovf);
+
+		testEnd(success);
+	// ---- Test 36 ----
+		testStart();
+
+		struct sorted_array* sud = sanew(sizeof(int), 4, cmp_int);
+		struct sorted_array* sua = sanew(sizeof(int), 4, cmp_int);
+		struct sorted_array* sub = sanew(sizeof(int), 4, cmp_int);
+		for (int k = 0; k < 3; k++)
+		{
+			int ka = k * 10, kb = k * 10 + 5, kd = k + 100;
+			saput(sua, &ka);
+			saput(sub, &kb);
+			saput(sud, &kd);
+		}
+		success = saunion(sud, sua, sub) == -1 && errno == ENOBUFS && salen(sud) == 3;
+		errno = 0;
+		for (int k = 0; k < 3; k++)
+			success &= *(int*)saget(sud, k) == k + 100;
+		success &= saintersect(sud, sua, sub) == 0 && salen(sud) == 0;
+		sadelete(sud);
+		sadelete(sua);
+		sadelete(sub);
+
+		testEnd(success);
+	// ---- Test 37 ----
+		testStart();
+
+		struct sorted_array* smd = sanew(sizeof(int), 4, cmp_int);
+		struct sorted_array* smsrc[2] = { sanew(sizeof(int), 4, cmp_int), sanew(sizeof(int), 4, cmp_int) };
+		for (int k = 0; k < 3; k++)
+		{
+			int ka = k * 2, kb = k * 2 + 1, kd = k + 100;
+			saput(smsrc[0], &ka);
+			saput(smsrc[1], &kb);
+			saput(smd, &kd);
+		}
+		success = samerge(smd, smsrc, 2) == -1 && errno == ENOBUFS && salen(smd) == 3;
+		errno = 0;
+		for (int k = 0; k < 3; k++)
+			success &= *(int*)saget(smd, k) == k + 100;
+		success &= samerge(smd, smsrc, 1) == 0 && salen(smd) == 3 && *(int*)saget(smd, 2) == 4;
+		sadelete(smd);
+		sadelete(smsrc[0]);
+		sadelete(smsrc[1]);
+
+		testEnd(success);
 	} 
 	catch (int err) 
 	{
@@ -1,7 +1,61 @@
+#include "sorted_array.h"
+
 #include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/// Buffers of at least this size are mapped directly, so that growing them remaps pages instead of copying bytes.
+#define SA_MAP_THRESHOLD ((size_t)1 << 20)
+
+/// The smallest capacity a growable array grows to.
+#define SA_MIN_GROW 16
+
+/// Size of a huge page, to which huge page buffers are rounded up.
+#define SA_HUGE_PAGE ((size_t)2 << 20)
+
+/// Size of a cache line, to which SA_ALLOC_ALIGNED buffers are aligned.
+#define SA_CACHE_LINE 64
+
+/// A block of a blocked array: a sorted run of up to @p block_elems elements.
+struct sa_block
+{
+	size_t n;
+	size_t refs;	///< Number of block tables sharing the block
+	char data[];
+};
+
+/// The table of blocks of a blocked array.
+struct sa_blocktab
+{
+	struct sa_block** blocks;
+	size_t* start;	///< start[b] is the index of the first element of block b; start[nblocks] is n
+	char* fences;	///< Copies of the first elements of all blocks, one by one
+	size_t nblocks;
+	size_t cap;
+	size_t refs;	///< Number of arrays sharing the table, see sasnapshot()
+};
+
+/// A buffer replaced while concurrent readers could still be reading it.
+struct sa_retired
+{
+	struct sa_retired* next;
+	void* buffer;
+	size_t bytes;
+	int mapped;
+};
 
 struct sorted_array
 {
@@ -9,6 +63,44 @@ struct sorted_array
 	size_t elem_size;
 	size_t max_elems;
 
+	size_t buf_bytes;
+	int buf_mapped;
+	int buf_borrowed;	///< The buffer belongs to the caller of saloadmem()
+	int buf_hugetlb;	///< The buffer is mapped with MAP_HUGETLB
+	struct sa_allocator allocator;	///< Allocator of the struct, the buffer and iterators; all NULL for malloc()
+	int alloc_flags;
+	int growable;
+
+	char* eytz;
+	size_t* eytz_rank;
+	size_t eytz_cap;
+	int indexed;
+	int index_valid;
+
+	enum sa_key_type key_type;
+	size_t (*count_kernel)(const void* p, size_t len, const void* key, int upper);
+
+	struct sa_blocktab* tab;
+	size_t block_elems;
+
+	char* wbuf;
+	size_t wbuf_n;
+	size_t wbuf_cap;
+
+	size_t threads;
+
+	size_t* touched;
+	size_t touched_n;
+	size_t touched_cap;
+	size_t touched_elems;
+	int touched_all;
+
+	unsigned long seq;
+	int concurrent;
+	struct sa_retired* retired;
+
+	struct sa_file* file;
+
 	int (*compar)(const void* a, const void* b);
 
 	size_t n;
@@ -18,6 +110,21 @@ struct sa_iter
 {
 	struct sorted_array* array;
 	size_t i;
+	struct sa_allocator allocator;	///< Copy of the allocator of the array, which may be deleted first
+};
+
+/**
+ * A loser tree over k arrays.
+ *
+ * Leaf i (array i) is node k + i, internal nodes 1..k-1 keep the loser of the match played in them,
+ * and tree[0] keeps the overall winner, so advancing the winner replays only the matches on its path to the root.
+ */
+struct sa_merge_iter
+{
+	struct sorted_array** arrays;
+	size_t k;
+	size_t* pos;
+	size_t* tree;
 };
 
 
@@ -25,11 +132,353 @@ struct sa_iter
 
 // ===============================  Supplementary funcs  ==================================
 
-inline void* getElem(struct sorted_array* array, size_t index)
+inline size_t pageAlign(size_t bytes)
+{
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	return (bytes + page - 1) / page * page;
+}
+
+/// Allocate @p bytes aligned to @p align with @p allocator, or with malloc(), if it is not set.
+void* allocWith(const struct sa_allocator* allocator, size_t bytes, size_t align)
+{
+	void* p = NULL;
+	if (allocator->alloc != NULL)
+		p = allocator->alloc(allocator->ctx, bytes, align);
+	else if (align > alignof(max_align_t))
+	{
+		if (posix_memalign(&p, align, bytes) != 0)
+			p = NULL;
+	}
+	else
+		p = malloc(bytes);
+
+	if (p == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+void freeWith(const struct sa_allocator* allocator, void* p, size_t bytes)
+{
+	if (allocator->alloc != NULL)
+		allocator->free(allocator->ctx, p, bytes);
+	else
+		free(p);
+}
+
+inline size_t bufferAlign(struct sorted_array* array)
+{
+	return (array->alloc_flags & SA_ALLOC_ALIGNED) ? SA_CACHE_LINE : alignof(max_align_t);
+}
+
+/// Round the size of a mapped buffer of @p array up to whole pages, or huge pages, if it asks for them.
+inline size_t mapAlign(struct sorted_array* array, size_t bytes)
+{
+	if (array->alloc_flags & (SA_ALLOC_HUGEPAGES | SA_ALLOC_HUGETLB))
+		return (bytes + SA_HUGE_PAGE - 1) / SA_HUGE_PAGE * SA_HUGE_PAGE;
+	return pageAlign(bytes);
+}
+
+/// Ask for transparent huge pages under a mapped buffer, if @p array wants them. Failing to get them is not an error.
+void adviseHuge(struct sorted_array* array, void* p, size_t bytes)
+{
+#ifdef MADV_HUGEPAGE
+	if ((array->alloc_flags & (SA_ALLOC_HUGEPAGES | SA_ALLOC_HUGETLB)) && !array->buf_hugetlb)
+	{
+		int saved = errno;
+		madvise(p, bytes, MADV_HUGEPAGE);
+		errno = saved;
+	}
+#endif
+}
+
+/**
+ * Map a buffer of @p bytes for @p array, rounding @p bytes up.
+ *
+ * SA_ALLOC_HUGETLB tries reserved huge pages first, and falls back to transparent ones, when there are none.
+ */
+void* mapBuffer(struct sorted_array* array, size_t* bytes)
+{
+	*bytes = mapAlign(array, *bytes);
+	array->buf_hugetlb = 0;
+
+	void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (array->alloc_flags & SA_ALLOC_HUGETLB)
+	{
+		p = mmap(NULL, *bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		array->buf_hugetlb = p != MAP_FAILED;
+	}
+#endif
+	if (p == MAP_FAILED)
+		p = mmap(NULL, *bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	adviseHuge(array, p, *bytes);
+	return p;
+}
+
+/// Allocate a buffer of @p bytes for @p array. Large buffers are mapped directly, unless the array has its own allocator.
+int allocBuffer(struct sorted_array* array, size_t bytes)
+{
+	if (bytes >= SA_MAP_THRESHOLD && array->allocator.alloc == NULL)
+	{
+		int saved = errno;
+		void* p = mapBuffer(array, &bytes);
+		if (p == NULL)
+			return -1;
+		errno = saved;
+		array->buffer = p;
+		array->buf_mapped = 1;
+	}
+	else
+	{
+		array->buffer = allocWith(&array->allocator, bytes, bufferAlign(array));
+		if (array->buffer == NULL)
+			return -1;
+		array->buf_mapped = 0;
+		array->buf_hugetlb = 0;
+	}
+
+	array->buf_bytes = bytes;
+	array->buf_borrowed = 0;
+	return 0;
+}
+
+void closeFile(struct sorted_array* array);
+
+void freeBuffer(struct sorted_array* array)
+{
+	if (array->file != NULL)
+		closeFile(array);
+	else if (array->buf_borrowed)
+		return;
+	else if (array->buf_mapped)
+		munmap(array->buffer, array->buf_bytes);
+	else
+		freeWith(&array->allocator, array->buffer, array->buf_bytes);
+}
+
+/// Free buffers retired by a concurrent array. No reader may run at that time.
+void freeRetired(struct sorted_array* array)
+{
+	while (array->retired != NULL)
+	{
+		struct sa_retired* r = array->retired;
+		array->retired = r->next;
+
+		struct sorted_array old = *array;
+		old.buffer = r->buffer;
+		old.buf_bytes = r->bytes;
+		old.buf_mapped = r->mapped;
+		old.file = NULL;
+		old.buf_borrowed = 0;
+		freeBuffer(&old);
+		free(r);
+	}
+}
+
+/// Check whether the heap buffer of @p array can be resized to @p bytes in place. Realloc doesn't keep an alignment.
+inline int canRealloc(struct sorted_array* array, size_t bytes)
+{
+	if (array->buf_mapped || array->buf_borrowed || array->concurrent || (array->alloc_flags & SA_ALLOC_ALIGNED))
+		return 0;
+	if (array->allocator.alloc != NULL)
+		return array->allocator.realloc != NULL;
+	return bytes < SA_MAP_THRESHOLD;
+}
+
+int resizeFile(struct sorted_array* array, size_t max_elems);
+
+/**
+ * Change the capacity of @p array to @p max_elems elements, keeping the stored ones.
+ *
+ * Mapped buffers are resized with mremap(), which moves page table entries instead of copying the contents,
+ * so the cost does not depend on the number of stored elements.
+ * The contents are copied only once, when a buffer crosses SA_MAP_THRESHOLD.
+ *
+ * Buffers of concurrent arrays are always copied, and the old one is retired, as readers may still be in it.
+ * A capacity, whose size in bytes overflows size_t, fails with ENOMEM.
+ */
+int resizeBuffer(struct sorted_array* array, size_t max_elems)
+{
+	if (max_elems > SIZE_MAX / array->elem_size)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	// Blocks of a blocked array are allocated on demand
+	if (array->tab != NULL)
+	{
+		array->max_elems = max_elems;
+		return 0;
+	}
+
+	if (array->file != NULL)
+		return resizeFile(array, max_elems);
+
+	size_t bytes = max_elems * array->elem_size;
+	if (bytes == 0)
+		bytes = 1;
+
+	if (array->buf_mapped && !array->buf_hugetlb && bytes >= SA_MAP_THRESHOLD && !array->concurrent)
+	{
+		bytes = mapAlign(array, bytes);
+		void* p = mremap(array->buffer, array->buf_bytes, bytes, MREMAP_MAYMOVE);
+		if (p == MAP_FAILED)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		array->buffer = p;
+		array->buf_bytes = bytes;
+		adviseHuge(array, p, bytes);
+	}
+	else if (canRealloc(array, bytes))
+	{
+		void* p = array->allocator.alloc != NULL ? 
+			array->allocator.realloc(array->allocator.ctx, array->buffer, array->buf_bytes, bytes) : 
+			realloc(array->buffer, bytes);
+		if (p == NULL)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		array->buffer = p;
+		array->buf_bytes = bytes;
+	}
+	else if (array->concurrent)
+	{
+		struct sa_retired* r = (struct sa_retired*) malloc(sizeof(struct sa_retired));
+		if (r == NULL)
+			return -1;
+
+		struct sorted_array old = *array;
+		if (allocBuffer(array, bytes) != 0)
+		{
+			free(r);
+			*array = old;
+			return -1;
+		}
+		void* buffer = array->buffer;
+		array->buffer = old.buffer;
+		memcpy(buffer, old.buffer, array->n * array->elem_size);
+		// The new buffer must be visible before any count that needs it
+		__atomic_store_n(&array->buffer, buffer, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		*r = (struct sa_retired) { array->retired, old.buffer, old.buf_bytes, old.buf_mapped };
+		array->retired = r;
+	}
+	else
+	{
+		struct sorted_array old = *array;
+		if (allocBuffer(array, bytes) != 0)
+		{
+			*array = old;
+			return -1;
+		}
+		memcpy(array->buffer, old.buffer, array->n * array->elem_size);
+		freeBuffer(&old);
+	}
+
+	array->max_elems = max_elems;
+	return 0;
+}
+
+/// Get the capacity a growable @p array grows to, when it needs @p need elements. The doubling saturates at the largest one, that fits in size_t bytes.
+size_t grownCapacity(struct sorted_array* array, size_t need)
+{
+	size_t limit = SIZE_MAX / array->elem_size;
+	size_t cap = array->max_elems > limit / 2 ? limit : array->max_elems * 2;
+	if (cap < SA_MIN_GROW)
+		cap = SA_MIN_GROW;
+	if (cap < need)
+		cap = need;
+	return cap;
+}
+
+/**
+ * Make space for @p count more elements.
+ *
+ * Growable arrays at least double their capacity, so the cost of growing is amortized over the insertions.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+int ensureSpace(struct sorted_array* array, size_t count)
+{
+	if (count <= array->max_elems - array->n - array->wbuf_n)
+		return 0;
+
+	if (!array->growable)
+	{
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	size_t used = array->n + array->wbuf_n;
+	if (count > SIZE_MAX - used)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return resizeBuffer(array, grownCapacity(array, used + count));
+}
+
+/**
+ * Copy the elements of a buffer borrowed by saloadmem() to a buffer of the array's own.
+ *
+ * The caller's image is never written to, so every change of the elements calls this first.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+int ownBuffer(struct sorted_array* array)
+{
+	if (!array->buf_borrowed)
+		return 0;
+	return resizeBuffer(array, array->max_elems);
+}
+
+/**
+ * Make space for @p count elements, that are going to replace the contents of @p array.
+ *
+ * The contents are kept, so @p array is left untouched if this fails.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+int replaceSpace(struct sorted_array* array, size_t count)
+{
+	if (count <= array->max_elems)
+		return ownBuffer(array);
+
+	if (!array->growable)
+	{
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	return resizeBuffer(array, grownCapacity(array, count));
+}
+
+size_t locateBlock(struct sorted_array* array, size_t index);
+
+inline void* flatElem(struct sorted_array* array, size_t index)
 {
 	return (char*)array->buffer + index * array->elem_size;
 }
 
+inline void* getElem(struct sorted_array* array, size_t index)
+{
+	if (array->tab != NULL)
+	{
+		size_t b = locateBlock(array, index);
+		return array->tab->blocks[b]->data + (index - array->tab->start[b]) * array->elem_size;
+	}
+	return flatElem(array, index);
+}
+
 inline int cmp(struct sorted_array* array, size_t a_index, size_t b_index)
 {
 	return array->compar(getElem(array, a_index), getElem(array, b_index));
@@ -64,35 +513,795 @@ void shifLeft(struct sorted_array* array, size_t index, size_t shift)
 		*(p) = *(p + shift);
 }
 
-/// Find the first element >= @p elem
-size_t findPlaceLeft(struct sorted_array* array, void* elem)
+// ----------- SIMD kernels --------------
+
+/**
+ * A kernel counts the elements of @p len primitive keys at @p p that are less than (or, if @p upper is set, 
+ * less than or equal to) the key at @p key. Since the keys are sorted, the count is the offset of the bound.
+ */
+typedef size_t (*count_kernel)(const void* p, size_t len, const void* key, int upper);
+
+/// Search windows of this many bytes and less are scanned linearly by a count kernel instead of being bisected.
+#define SA_SIMD_WINDOW 256
+
+template <typename K> size_t countScalar(const void* p, size_t len, const void* key, int upper)
 {
-	if (array->n == 0)
-		return 0;
-	if (cmp(array, 0, elem) >= 0)
-		return 0;
-	if (cmp(array, array->n - 1, elem) < 0)
-		return array->n;
+	const K* a = (const K*) p;
+	K x = *(const K*) key;
+	size_t count = 0;
+
+	if (upper)
+		for (size_t i = 0; i < len; i++)
+			count += a[i] <= x;
+	else
+		for (size_t i = 0; i < len; i++)
+			count += a[i] < x;
+
+	return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2"))) size_t countI32Avx2(const void* p, size_t len, const void* key, int upper)
+{
+	const int32_t* a = (const int32_t*) p;
+	__m256i x = _mm256_set1_epi32(*(const int32_t*) key);
+	size_t count = 0, i = 0;
+
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i m = upper ? _mm256_cmpgt_epi32(v, x) : _mm256_cmpgt_epi32(x, v);
+		int bits = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+		count += upper ? 8 - bits : bits;
+	}
+	return count + countScalar<int32_t>(a + i, len - i, key, upper);
+}
 
+__attribute__((target("avx2"))) size_t countI64Avx2(const void* p, size_t len, const void* key, int upper)
+{
+	const int64_t* a = (const int64_t*) p;
+	__m256i x = _mm256_set1_epi64x(*(const int64_t*) key);
+	size_t count = 0, i = 0;
+
+	for (; i + 4 <= len; i += 4)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i m = upper ? _mm256_cmpgt_epi64(v, x) : _mm256_cmpgt_epi64(x, v);
+		int bits = __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+		count += upper ? 4 - bits : bits;
+	}
+	return count + countScalar<int64_t>(a + i, len - i, key, upper);
+}
+
+__attribute__((target("avx2"))) size_t countF32Avx2(const void* p, size_t len, const void* key, int upper)
+{
+	const float* a = (const float*) p;
+	__m256 x = _mm256_set1_ps(*(const float*) key);
+	size_t count = 0, i = 0;
+
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256 v = _mm256_loadu_ps(a + i);
+		__m256 m = upper ? _mm256_cmp_ps(v, x, _CMP_LE_OQ) : _mm256_cmp_ps(v, x, _CMP_LT_OQ);
+		count += __builtin_popcount(_mm256_movemask_ps(m));
+	}
+	return count + countScalar<float>(a + i, len - i, key, upper);
+}
+
+__attribute__((target("avx2"))) size_t countF64Avx2(const void* p, size_t len, const void* key, int upper)
+{
+	const double* a = (const double*) p;
+	__m256d x = _mm256_set1_pd(*(const double*) key);
+	size_t count = 0, i = 0;
+
+	for (; i + 4 <= len; i += 4)
+	{
+		__m256d v = _mm256_loadu_pd(a + i);
+		__m256d m = upper ? _mm256_cmp_pd(v, x, _CMP_LE_OQ) : _mm256_cmp_pd(v, x, _CMP_LT_OQ);
+		count += __builtin_popcount(_mm256_movemask_pd(m));
+	}
+	return count + countScalar<double>(a + i, len - i, key, upper);
+}
+
+__attribute__((target("sse4.2"))) size_t countI32Sse4(const void* p, size_t len, const void* key, int upper)
+{
+	const int32_t* a = (const int32_t*) p;
+	__m128i x = _mm_set1_epi32(*(const int32_t*) key);
+	size_t count = 0, i = 0;
+
+	for (; i + 4 <= len; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i m = upper ? _mm_cmpgt_epi32(v, x) : _mm_cmpgt_epi32(x, v);
+		int bits = __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(m)));
+		count += upper ? 4 - bits : bits;
+	}
+	return count + countScalar<int32_t>(a + i, len - i, key, upper);
+}
+
+__attribute__((target("sse4.2"))) size_t countI64Sse4(const void* p, size_t len, const void* key, int upper)
+{
+	const int64_t* a = (const int64_t*) p;
+	__m128i x = _mm_set1_epi64x(*(const int64_t*) key);
+	size_t count = 0, i = 0;
+
+	for (; i + 2 <= len; i += 2)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i m = upper ? _mm_cmpgt_epi64(v, x) : _mm_cmpgt_epi64(x, v);
+		int bits = __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(m)));
+		count += upper ? 2 - bits : bits;
+	}
+	return count + countScalar<int64_t>(a + i, len - i, key, upper);
+}
+
+__attribute__((target("sse4.2"))) size_t countF32Sse4(const void* p, size_t len, const void* key, int upper)
+{
+	const float* a = (const float*) p;
+	__m128 x = _mm_set1_ps(*(const float*) key);
+	size_t count = 0, i = 0;
+
+	for (; i + 4 <= len; i += 4)
+	{
+		__m128 v = _mm_loadu_ps(a + i);
+		__m128 m = upper ? _mm_cmple_ps(v, x) : _mm_cmplt_ps(v, x);
+		count += __builtin_popcount(_mm_movemask_ps(m));
+	}
+	return count + countScalar<float>(a + i, len - i, key, upper);
+}
+
+__attribute__((target("sse4.2"))) size_t countF64Sse4(const void* p, size_t len, const void* key, int upper)
+{
+	const double* a = (const double*) p;
+	__m128d x = _mm_set1_pd(*(const double*) key);
+	size_t count = 0, i = 0;
+
+	for (; i + 2 <= len; i += 2)
+	{
+		__m128d v = _mm_loadu_pd(a + i);
+		__m128d m = upper ? _mm_cmple_pd(v, x) : _mm_cmplt_pd(v, x);
+		count += __builtin_popcount(_mm_movemask_pd(m));
+	}
+	return count + countScalar<double>(a + i, len - i, key, upper);
+}
+
+#endif
+
+/// Pick the best count kernel for @p type supported by the running CPU.
+count_kernel selectKernel(enum sa_key_type type)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		switch (type)
+		{
+			case SA_KEY_INT32:	return countI32Avx2;
+			case SA_KEY_INT64:	return countI64Avx2;
+			case SA_KEY_FLOAT:	return countF32Avx2;
+			case SA_KEY_DOUBLE:	return countF64Avx2;
+			default:			return NULL;
+		}
+	}
+	if (__builtin_cpu_supports("sse4.2"))
+	{
+		switch (type)
+		{
+			case SA_KEY_INT32:	return countI32Sse4;
+			case SA_KEY_INT64:	return countI64Sse4;
+			case SA_KEY_FLOAT:	return countF32Sse4;
+			case SA_KEY_DOUBLE:	return countF64Sse4;
+			default:			return NULL;
+		}
+	}
+#endif
+	switch (type)
+	{
+		case SA_KEY_INT32:	return countScalar<int32_t>;
+		case SA_KEY_INT64:	return countScalar<int64_t>;
+		case SA_KEY_FLOAT:	return countScalar<float>;
+		case SA_KEY_DOUBLE:	return countScalar<double>;
+		default:			return NULL;
+	}
+}
 
+/**
+ * Find the first key >= @p elem (or > @p elem if @p upper is set) in an array of primitive keys.
+ *
+ * Bisects with native comparisons until the window fits in SA_SIMD_WINDOW bytes, then scans it with the count kernel.
+ */
+template <typename K> size_t keySearch(struct sorted_array* array, const void* base, size_t len, void* elem, int upper)
+{
+	const K* a = (const K*) base;
+	K x = *(const K*) elem;
 	size_t left = 0;
-	size_t right = array->n - 1;
-	size_t center;
-	while (left + 1 < right)
+	size_t right = len;
+
+	while (right - left > SA_SIMD_WINDOW / sizeof(K))
 	{
-		center = (left + right) / 2;
-		int sign = cmp(array, center, elem);
-		if (sign < 0)
-			left = center;
+		size_t center = left + (right - left) / 2;
+		if (upper ? a[center] <= x : a[center] < x)
+			left = center + 1;
 		else
 			right = center;
 	}
-	return right;
+
+	return left + array->count_kernel(a + left, right - left, elem, upper);
+}
+
+inline size_t keySearch(struct sorted_array* array, const void* base, size_t len, void* elem, int upper)
+{
+	switch (array->key_type)
+	{
+		case SA_KEY_INT32:	return keySearch<int32_t>(array, base, len, elem, upper);
+		case SA_KEY_INT64:	return keySearch<int64_t>(array, base, len, elem, upper);
+		case SA_KEY_FLOAT:	return keySearch<float>(array, base, len, elem, upper);
+		default:			return keySearch<double>(array, base, len, elem, upper);
+	}
+}
+
+// ----------- Blocked layout --------------
+
+/// Default number of bytes in one block of a blocked array.
+#define SA_BLOCK_BYTES 16384
+
+struct sa_block* newBlock(struct sorted_array* array)
+{
+	struct sa_block* block = (struct sa_block*) malloc(sizeof(struct sa_block) + array->block_elems * array->elem_size);
+	if (block != NULL)
+	{
+		block->n = 0;
+		block->refs = 1;
+	}
+	return block;
+}
+
+/// Drop a reference to @p block, freeing it with the last one.
+inline void releaseBlock(struct sa_block* block)
+{
+	if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(block);
+}
+
+/// Drop a reference to @p tab, freeing it and releasing its blocks with the last one.
+void releaseTable(struct sa_blocktab* tab)
+{
+	if (__atomic_sub_fetch(&tab->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+
+	for (size_t b = 0; b < tab->nblocks; b++)
+		releaseBlock(tab->blocks[b]);
+	free(tab->blocks);
+	free(tab->start);
+	free(tab->fences);
+	free(tab);
+}
+
+/**
+ * Make the blocks [@p from, @p to) and the block table of @p array private to it, before they are changed.
+ *
+ * A table shared with snapshots is copied first, which shares every block with one more table.
+ * Then only the given shared blocks are copied, so a change after a snapshot copies the blocks it touches and nothing else.
+ * @return 0 on success, -1 with errno set otherwise; nothing shared is changed in case of an error.
+ */
+int ownBlocks(struct sorted_array* array, size_t from, size_t to)
+{
+	struct sa_blocktab* tab = array->tab;
+	if (__atomic_load_n(&tab->refs, __ATOMIC_ACQUIRE) > 1)
+	{
+		struct sa_blocktab* copy = (struct sa_blocktab*) calloc(1, sizeof(struct sa_blocktab));
+		if (copy == NULL)
+			return -1;
+		copy->blocks = (struct sa_block**) malloc((tab->cap + 1) * sizeof(struct sa_block*));
+		copy->start = (size_t*) malloc((tab->cap + 1) * sizeof(size_t));
+		copy->fences = (char*) malloc(tab->cap * array->elem_size + 1);
+		if (copy->blocks == NULL || copy->start == NULL || copy->fences == NULL)
+		{
+			free(copy->blocks);
+			free(copy->start);
+			free(copy->fences);
+			free(copy);
+			return -1;
+		}
+
+		memcpy(copy->blocks, tab->blocks, tab->nblocks * sizeof(struct sa_block*));
+		memcpy(copy->start, tab->start, (tab->nblocks + 1) * sizeof(size_t));
+		memcpy(copy->fences, tab->fences, tab->nblocks * array->elem_size);
+		copy->nblocks = tab->nblocks;
+		copy->cap = tab->cap;
+		copy->refs = 1;
+		for (size_t b = 0; b < tab->nblocks; b++)
+			__atomic_add_fetch(&tab->blocks[b]->refs, 1, __ATOMIC_RELAXED);
+
+		array->tab = copy;
+		releaseTable(tab);
+		tab = copy;
+	}
+
+	if (to > tab->nblocks)
+		to = tab->nblocks;
+	for (size_t b = from; b < to; b++)
+	{
+		struct sa_block* block = tab->blocks[b];
+		if (__atomic_load_n(&block->refs, __ATOMIC_ACQUIRE) == 1)
+			continue;
+
+		struct sa_block* copy = newBlock(array);
+		if (copy == NULL)
+			return -1;
+		copy->n = block->n;
+		memcpy(copy->data, block->data, block->n * array->elem_size);
+		tab->blocks[b] = copy;
+		releaseBlock(block);
+	}
+	return 0;
+}
+
+inline char* blockElem(struct sorted_array* array, struct sa_block* block, size_t index)
+{
+	return block->data + index * array->elem_size;
+}
+
+/// Copy the first element of block @p b into the fence keys.
+inline void updateFence(struct sorted_array* array, size_t b)
+{
+	struct sa_blocktab* tab = array->tab;
+	memcpy(tab->fences + b * array->elem_size, tab->blocks[b]->data, array->elem_size);
+}
+
+/// Recompute cumulative counts of elements for blocks starting from @p b.
+void updateStarts(struct sorted_array* array, size_t b)
+{
+	struct sa_blocktab* tab = array->tab;
+	for (; b < tab->nblocks; b++)
+		tab->start[b + 1] = tab->start[b] + tab->blocks[b]->n;
+}
+
+/// Make space in the block table for one more block.
+int growTable(struct sorted_array* array)
+{
+	struct sa_blocktab* tab = array->tab;
+	if (tab->nblocks < tab->cap)
+		return 0;
+
+	size_t cap = tab->cap < 8 ? 8 : tab->cap * 2;
+	struct sa_block** blocks = (struct sa_block**) realloc(tab->blocks, cap * sizeof(struct sa_block*));
+	if (blocks == NULL)
+		return -1;
+	tab->blocks = blocks;
+
+	size_t* start = (size_t*) realloc(tab->start, (cap + 1) * sizeof(size_t));
+	if (start == NULL)
+		return -1;
+	tab->start = start;
+
+	char* fences = (char*) realloc(tab->fences, cap * array->elem_size);
+	if (fences == NULL)
+		return -1;
+	tab->fences = fences;
+
+	tab->cap = cap;
+	return 0;
+}
+
+/// Insert @p block into the table at position @p b. The table must have space for it.
+void insertBlock(struct sorted_array* array, size_t b, struct sa_block* block)
+{
+	struct sa_blocktab* tab = array->tab;
+	size_t size = array->elem_size;
+
+	memmove(tab->blocks + b + 1, tab->blocks + b, (tab->nblocks - b) * sizeof(struct sa_block*));
+	memmove(tab->fences + (b + 1) * size, tab->fences + b * size, (tab->nblocks - b) * size);
+	tab->blocks[b] = block;
+	tab->nblocks++;
+	if (block->n > 0)
+		updateFence(array, b);
+}
+
+/// Remove the block at position @p b from the table and free it.
+void removeBlock(struct sorted_array* array, size_t b)
+{
+	struct sa_blocktab* tab = array->tab;
+	size_t size = array->elem_size;
+
+	releaseBlock(tab->blocks[b]);
+	memmove(tab->blocks + b, tab->blocks + b + 1, (tab->nblocks - b - 1) * sizeof(struct sa_block*));
+	memmove(tab->fences + b * size, tab->fences + (b + 1) * size, (tab->nblocks - b - 1) * size);
+	tab->nblocks--;
+}
+
+/// Find the block containing the element with @p index, using the cumulative counts.
+inline size_t locateBlock(struct sorted_array* array, size_t index)
+{
+	struct sa_blocktab* tab = array->tab;
+	size_t left = 0;
+	size_t right = tab->nblocks;
+
+	while (left + 1 < right)
+	{
+		size_t center = (left + right) / 2;
+		if (tab->start[center] <= index)
+			left = center;
+		else
+			right = center;
+	}
+	return left;
+}
+
+/**
+ * Count the blocks whose fence key is less than (or, if @p upper is set, less than or equal to) @p elem.
+ *
+ * Only the contiguous fence keys are touched, so the search doesn't fault in the blocks themselves.
+ */
+size_t searchFences(struct sorted_array* array, void* elem, int upper)
+{
+	struct sa_blocktab* tab = array->tab;
+	size_t left = 0;
+	size_t right = tab->nblocks;
+
+	while (left < right)
+	{
+		size_t center = (left + right) / 2;
+		int sign = array->compar(tab->fences + center * array->elem_size, elem);
+		if (upper ? sign <= 0 : sign < 0)
+			left = center + 1;
+		else
+			right = center;
+	}
+	return left;
+}
+
+/// Find the first element >= @p elem (or > @p elem if @p upper is set) in a blocked array.
+size_t blockSearch(struct sorted_array* array, void* elem, int upper)
+{
+	size_t b = searchFences(array, elem, upper);
+	if (b == 0)
+		return 0;
+	b--;
+
+	struct sa_block* block = array->tab->blocks[b];
+	if (array->key_type != SA_KEY_NONE)
+		return array->tab->start[b] + keySearch(array, block->data, block->n, elem, upper);
+
+	size_t left = 1;
+	size_t right = block->n;
+	while (left < right)
+	{
+		size_t center = (left + right) / 2;
+		int sign = array->compar(blockElem(array, block, center), elem);
+		if (upper ? sign <= 0 : sign < 0)
+			left = center + 1;
+		else
+			right = center;
+	}
+	return array->tab->start[b] + left;
+}
+
+/**
+ * Insert a copy of @p elem into a blocked array after the equal elements.
+ *
+ * Only the elements of one block are shifted. A full block is split in two halves first.
+ */
+int blockInsert(struct sorted_array* array, void* elem)
+{
+	if (ownBlocks(array, 0, 0) != 0)
+		return -1;
+
+	struct sa_blocktab* tab = array->tab;
+	size_t size = array->elem_size;
+
+	if (growTable(array) != 0)
+		return -1;
+
+	size_t b = 0;
+	if (tab->nblocks == 0)
+	{
+		struct sa_block* block = newBlock(array);
+		if (block == NULL)
+			return -1;
+		insertBlock(array, 0, block);
+	}
+	else
+	{
+		b = searchFences(array, elem, 1);
+		if (b > 0)
+			b--;
+		if (ownBlocks(array, b, b + 1) != 0)
+			return -1;
+	}
+
+	size_t first = b;
+	struct sa_block* block = tab->blocks[b];
+	if (block->n == array->block_elems)
+	{
+		struct sa_block* half = newBlock(array);
+		if (half == NULL)
+			return -1;
+
+		half->n = block->n / 2;
+		block->n -= half->n;
+		memcpy(half->data, blockElem(array, block, block->n), half->n * size);
+		insertBlock(array, b + 1, half);
+
+		if (array->compar(half->data, elem) <= 0)
+			block = tab->blocks[++b];
+	}
+
+	size_t left = 0;
+	size_t right = block->n;
+	while (left < right)
+	{
+		size_t center = (left + right) / 2;
+		if (array->compar(blockElem(array, block, center), elem) <= 0)
+			left = center + 1;
+		else
+			right = center;
+	}
+
+	memmove(blockElem(array, block, left + 1), blockElem(array, block, left), (block->n - left) * size);
+	memcpy(blockElem(array, block, left), elem, size);
+	block->n++;
+
+	if (left == 0)
+		updateFence(array, b);
+	updateStarts(array, first);
+	return 0;
+}
+
+/**
+ * Remove elements with indices in [@p from, @p to) from a blocked array.
+ *
+ * Only the tails of the affected blocks are shifted. Emptied blocks are freed,
+ * and a block that got less than a quarter full is merged with its neighbour, when they fit in half a block together.
+ * @return 0 on success, -1 with errno set if shared blocks couldn't be copied.
+ */
+int blockRemoveRange(struct sorted_array* array, size_t from, size_t to)
+{
+	if (from >= to)
+		return 0;
+
+	size_t first = locateBlock(array, from);
+	// The neighbours may be merged into
+	if (ownBlocks(array, first > 0 ? first - 1 : 0, locateBlock(array, to - 1) + 2) != 0)
+		return -1;
+
+	struct sa_blocktab* tab = array->tab;
+	size_t size = array->elem_size;
+	size_t b = first;
+	size_t count = to - from;
+
+	while (count > 0)
+	{
+		struct sa_block* block = tab->blocks[b];
+		size_t off = from - tab->start[b];
+		size_t cut = block->n - off < count ? block->n - off : count;
+
+		memmove(blockElem(array, block, off), blockElem(array, block, off + cut), (block->n - off - cut) * size);
+		block->n -= cut;
+		count -= cut;
+
+		if (block->n == 0)
+			removeBlock(array, b);
+		else
+		{
+			if (off == 0)
+				updateFence(array, b);
+			b++;
+		}
+		if (b < tab->nblocks)
+			tab->start[b] = from;
+	}
+
+	for (b = first > 0 ? first - 1 : 0; b + 1 < tab->nblocks && b <= first + 1; b++)
+	{
+		struct sa_block* block = tab->blocks[b];
+		struct sa_block* next = tab->blocks[b + 1];
+		if ((block->n < array->block_elems / 4 || next->n < array->block_elems / 4) && 
+			block->n + next->n <= array->block_elems / 2)
+		{
+			// Emptied blocks shift the following ones into the window, so they may still be shared
+			if (ownBlocks(array, b, b + 2) != 0)
+				return -1;
+			block = tab->blocks[b];
+			next = tab->blocks[b + 1];
+			memcpy(blockElem(array, block, block->n), next->data, next->n * size);
+			block->n += next->n;
+			removeBlock(array, b + 1);
+			break;
+		}
+	}
+
+	updateStarts(array, first > 0 ? first - 1 : 0);
+	return 0;
+}
+
+/**
+ * Remove the elements of a blocked array for which @p pred returns nonzero, compacting every block in place.
+ *
+ * Emptied blocks are freed and neighbours that fit in half a block together are merged.
+ * @return A number of removed elements, or (size_t)-1 with errno set if shared blocks couldn't be copied.
+ */
+size_t blockRemoveIf(struct sorted_array* array, int (*pred)(void* elem, void* context), void* context)
+{
+	if (ownBlocks(array, 0, array->tab->nblocks) != 0)
+		return (size_t)-1;
+
+	struct sa_blocktab* tab = array->tab;
+	size_t size = array->elem_size;
+	size_t removed = 0;
+
+	for (size_t b = 0; b < tab->nblocks; )
+	{
+		struct sa_block* block = tab->blocks[b];
+		size_t w = 0;
+		for (size_t r = 0; r < block->n; r++)
+		{
+			if (pred(blockElem(array, block, r), context))
+				continue;
+			if (w != r)
+				memcpy(blockElem(array, block, w), blockElem(array, block, r), size);
+			w++;
+		}
+		removed += block->n - w;
+		block->n = w;
+
+		if (block->n == 0)
+			removeBlock(array, b);
+		else
+			updateFence(array, b++);
+	}
+
+	for (size_t b = 0; b + 1 < tab->nblocks; )
+	{
+		struct sa_block* block = tab->blocks[b];
+		struct sa_block* next = tab->blocks[b + 1];
+		if (block->n + next->n <= array->block_elems / 2)
+		{
+			memcpy(blockElem(array, block, block->n), next->data, next->n * size);
+			block->n += next->n;
+			removeBlock(array, b + 1);
+		}
+		else
+			b++;
+	}
+
+	updateStarts(array, 0);
+	return removed;
+}
+
+/// Release the block table of @p array, freeing the blocks no snapshot shares.
+void freeBlocks(struct sorted_array* array)
+{
+	if (array->tab == NULL)
+		return;
+
+	releaseTable(array->tab);
+	array->tab = NULL;
+}
+
+// ----------- Search index --------------
+
+/**
+ * Build the Eytzinger (BFS order) copy of the elements.
+ *
+ * Slot k (starting from 1) has its children in slots 2k and 2k+1, so the first levels of every search
+ * share the same few cache lines, and the descendants of a slot are adjacent in memory and can be prefetched.
+ * @p eytz_rank maps every slot back to the index of the element in the sorted buffer.
+ */
+size_t fillEytzinger(struct sorted_array* array, size_t i, size_t k)
+{
+	if (k > array->n)
+		return i;
+
+	i = fillEytzinger(array, i, 2 * k);
+	memcpy(array->eytz + k * array->elem_size, getElem(array, i), array->elem_size);
+	array->eytz_rank[k] = i;
+	return fillEytzinger(array, i + 1, 2 * k + 1);
+}
+
+/// Rebuild the search index if it is enabled and has been invalidated by a mutation.
+void ensureIndex(struct sorted_array* array)
+{
+	if (!array->indexed || array->index_valid)
+		return;
+
+	if (array->eytz_cap < array->n + 1)
+	{
+		int err = errno;
+		size_t cap = array->n + 1;
+		char* eytz = (char*) realloc(array->eytz, cap * array->elem_size);
+		if (eytz != NULL)
+			array->eytz = eytz;
+		size_t* rank = (size_t*) realloc(array->eytz_rank, cap * sizeof(size_t));
+		if (rank != NULL)
+			array->eytz_rank = rank;
+
+		// Failing to build the index isn't an error, searches just go the plain way
+		errno = err;
+		if (eytz == NULL || rank == NULL)
+			return;
+		array->eytz_cap = cap;
+	}
+
+	fillEytzinger(array, 0, 1);
+	array->index_valid = 1;
+}
+
+inline void touchAll(struct sorted_array* array);
+
+/// Called on every change of the array. Positions of touched elements are stale after it as well.
+inline void invalidateIndex(struct sorted_array* array)
+{
+	array->index_valid = 0;
+	if (array->touched_n > 0)
+		touchAll(array);
+}
+
+/**
+ * Find the first element >= @p elem (or > @p elem if @p upper is set) using the Eytzinger index.
+ *
+ * The descent is branchless: the direction is added to the slot number instead of being branched on.
+ */
+inline size_t eytzSearch(struct sorted_array* array, void* elem, int upper)
+{
+	size_t size = array->elem_size;
+	size_t k = 1;
+
+	while (k <= array->n)
+	{
+		__builtin_prefetch(array->eytz + 16 * k * size);
+		int sign = array->compar(array->eytz + k * size, elem);
+		k = 2 * k + (upper ? sign <= 0 : sign < 0);
+	}
+
+	k >>= __builtin_ffsll(~k);
+	return k == 0 ? array->n : array->eytz_rank[k];
+}
+
+/// Find the first element >= @p elem
+size_t findPlaceLeft(struct sorted_array* array, void* elem)
+{
+	if (array->index_valid)
+		return eytzSearch(array, elem, 0);
+	if (array->tab != NULL)
+		return blockSearch(array, elem, 0);
+	if (array->key_type != SA_KEY_NONE)
+		return keySearch(array, array->buffer, array->n, elem, 0);
+
+	if (array->n == 0)
+		return 0;
+	if (cmp(array, 0, elem) >= 0)
+		return 0;
+	if (cmp(array, array->n - 1, elem) < 0)
+		return array->n;
+
+
+	size_t left = 0;
+	size_t right = array->n - 1;
+	size_t center;
+	while (left + 1 < right)
+	{
+		center = (left + right) / 2;
+		int sign = cmp(array, center, elem);
+		if (sign < 0)
+			left = center;
+		else
+			right = center;
+	}
+	return right;
 }
 
 ///Find the first element > @p elem
 size_t findPlaceRight(struct sorted_array* array, void* elem)
 {
+	if (array->index_valid)
+		return eytzSearch(array, elem, 1);
+	if (array->tab != NULL)
+		return blockSearch(array, elem, 1);
+	if (array->key_type != SA_KEY_NONE)
+		return keySearch(array, array->buffer, array->n, elem, 1);
+
 	if (array->n == 0)
 		return 0;
 	if (cmp(array, 0, elem) > 0)
@@ -101,390 +1310,4629 @@ size_t findPlaceRight(struct sorted_array* array, void* elem)
 		return array->n;
 
 
-	size_t left = 0;
-	size_t right = array->n - 1;
-	size_t center;
-	while (left + 1 < right)
+	size_t left = 0;
+	size_t right = array->n - 1;
+	size_t center;
+	while (left + 1 < right)
+	{
+		center = (left + right) / 2;
+		int sign = cmp(array, center, elem);
+		if (sign <= 0)
+			left = center;
+		else
+			right = center;
+	}
+	return right;
+}
+
+/**
+ * Merge a sorted @p batch of @p count elements into @p n sorted elements at @p base, filling it from the back.
+ *
+ * Every stored element is moved at most once. Elements of the batch are placed after the equal stored ones, as saput() does.
+ * There must be space for @p count more elements after @p base + @p n.
+ */
+void mergeInto(struct sorted_array* array, char* base, size_t n, const char* batch, size_t count)
+{
+	size_t size = array->elem_size;
+	char* out = base + (n + count) * size;
+	size_t i = n;
+	size_t j = count;
+
+	while (j > 0)
+	{
+		out -= size;
+		if (i > 0 && array->compar(base + (i - 1) * size, batch + (j - 1) * size) > 0)
+		{
+			i--;
+			memcpy(out, base + i * size, size);
+		}
+		else
+		{
+			j--;
+			memcpy(out, batch + j * size, size);
+		}
+	}
+}
+
+/**
+ * Merge a sorted @p batch of @p count elements into a flat array.
+ * The buffer must have space for @p count more elements.
+ */
+void mergeBack(struct sorted_array* array, const char* batch, size_t count)
+{
+	mergeInto(array, (char*)array->buffer, array->n, batch, count);
+	array->n += count;
+	invalidateIndex(array);
+}
+
+
+// ----------- Batched search --------------
+
+/// Number of searches run in lockstep by safindn().
+#define SA_BATCH_GROUP 16
+
+/**
+ * Find lower bounds of @p count keys in a flat array, running SA_BATCH_GROUP branchless searches in lockstep.
+ *
+ * All searches of a group take the same number of steps, and each one prefetches its next probe
+ * while the other searches of the group make their steps, so the cache misses overlap instead of forming one dependent chain.
+ */
+void lowerBoundsLockstep(struct sorted_array* array, const char* keys, size_t count, size_t* out)
+{
+	size_t size = array->elem_size;
+
+	for (size_t g = 0; g < count; g += SA_BATCH_GROUP)
+	{
+		size_t m = count - g < SA_BATCH_GROUP ? count - g : SA_BATCH_GROUP;
+		size_t* base = out + g;
+		const char* key = keys + g * size;
+
+		for (size_t q = 0; q < m; q++)
+			base[q] = 0;
+
+		for (size_t len = array->n; len > 1; len -= len / 2)
+		{
+			size_t half = len / 2;
+			size_t next = (len - half) / 2;
+			for (size_t q = 0; q < m; q++)
+			{
+				base[q] += (array->compar(flatElem(array, base[q] + half - 1), key + q * size) < 0) ? half : 0;
+				if (next > 0)
+					__builtin_prefetch(flatElem(array, base[q] + next - 1));
+			}
+		}
+
+		for (size_t q = 0; q < m; q++)
+			base[q] += array->compar(flatElem(array, base[q]), key + q * size) < 0;
+	}
+}
+
+/**
+ * Find the first element >= @p key at or after @p pos, galloping forward from @p pos.
+ *
+ * Costs O(log d) comparisons, where d is the distance to the result.
+ */
+size_t gallopLeft(struct sorted_array* array, size_t pos, const void* key)
+{
+	if (pos >= array->n || array->compar(getElem(array, pos), key) >= 0)
+		return pos;
+
+	size_t lo = pos;
+	size_t step = 1;
+	while (lo + step < array->n && array->compar(getElem(array, lo + step), key) < 0)
+	{
+		lo += step;
+		step *= 2;
+	}
+
+	size_t left = lo + 1;
+	size_t right = lo + step < array->n ? lo + step : array->n;
+	while (left < right)
+	{
+		size_t center = (left + right) / 2;
+		if (array->compar(getElem(array, center), key) < 0)
+			left = center + 1;
+		else
+			right = center;
+	}
+	return left;
+}
+
+/**
+ * Find lower bounds of @p count sorted keys in one forward sweep.
+ *
+ * Each search gallops from the bound of the previous key, so the whole sweep costs O(count * log(n / count)).
+ */
+void lowerBoundsSweep(struct sorted_array* array, const char* keys, size_t count, size_t* out)
+{
+	size_t pos = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		pos = gallopLeft(array, pos, keys + i * array->elem_size);
+		out[i] = pos;
+	}
+}
+
+// ----------- Sorting --------------
+
+/// Arrays shorter than this are sorted by one thread, whatever sathreads() says.
+#define SA_PAR_MIN 16384
+
+/// A part of a parallel sort run by one thread.
+struct sort_task
+{
+	struct sorted_array* array;
+	char* src;
+	char* dst;
+	size_t lo, mid, hi;
+};
+
+void* sortChunk(void* arg)
+{
+	struct sort_task* task = (struct sort_task*) arg;
+	size_t size = task->array->elem_size;
+	qsort(task->src + task->lo * size, task->hi - task->lo, size, task->array->compar);
+	return NULL;
+}
+
+/// Merge sorted runs [lo, mid) and [mid, hi) of @p src into [lo, hi) of @p dst.
+void* mergeChunks(void* arg)
+{
+	struct sort_task* task = (struct sort_task*) arg;
+	size_t size = task->array->elem_size;
+	const char* a = task->src + task->lo * size;
+	const char* a_end = task->src + task->mid * size;
+	const char* b = a_end;
+	const char* b_end = task->src + task->hi * size;
+	char* out = task->dst + task->lo * size;
+
+	while (a < a_end && b < b_end)
+	{
+		if (task->array->compar(b, a) < 0)
+		{
+			memcpy(out, b, size);
+			b += size;
+		}
+		else
+		{
+			memcpy(out, a, size);
+			a += size;
+		}
+		out += size;
+	}
+	memcpy(out, a, a_end - a);
+	memcpy(out + (a_end - a), b, b_end - b);
+	return NULL;
+}
+
+/// Run @p func on all @p count tasks, one thread per task. Tasks, for which a thread can't be created, are run by the caller.
+void runTasks(void* (*func)(void*), struct sort_task* tasks, pthread_t* threads, size_t count)
+{
+	int* started = (int*) calloc(count, sizeof(int));
+
+	for (size_t i = 1; i < count; i++)
+		if (started != NULL)
+			started[i] = pthread_create(&threads[i], NULL, func, &tasks[i]) == 0;
+
+	for (size_t i = 0; i < count; i++)
+		if (started == NULL || !started[i])
+			func(&tasks[i]);
+
+	for (size_t i = 1; i < count; i++)
+		if (started != NULL && started[i])
+			pthread_join(threads[i], NULL);
+
+	free(started);
+}
+
+/**
+ * Sort @p n elements at @p base with a parallel merge sort.
+ *
+ * The elements are split into @p nthreads chunks, that are sorted concurrently,
+ * and then merged pairwise in log(nthreads) rounds, every round running its merges concurrently.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+int parallelSort(struct sorted_array* array, char* base, size_t n, size_t nthreads)
+{
+	size_t size = array->elem_size;
+	char* tmp = (char*) malloc(n * size);
+	size_t* bounds = (size_t*) malloc((nthreads + 1) * sizeof(size_t));
+	struct sort_task* tasks = (struct sort_task*) malloc(nthreads * sizeof(struct sort_task));
+	pthread_t* threads = (pthread_t*) malloc(nthreads * sizeof(pthread_t));
+	if (tmp == NULL || bounds == NULL || tasks == NULL || threads == NULL)
+	{
+		free(tmp);
+		free(bounds);
+		free(tasks);
+		free(threads);
+		return -1;
+	}
+
+	for (size_t i = 0; i <= nthreads; i++)
+		bounds[i] = n * i / nthreads;
+
+	for (size_t i = 0; i < nthreads; i++)
+		tasks[i] = (struct sort_task) { array, base, NULL, bounds[i], bounds[i + 1], bounds[i + 1] };
+	runTasks(sortChunk, tasks, threads, nthreads);
+
+	char* src = base;
+	char* dst = tmp;
+	for (size_t width = 1; width < nthreads; width *= 2)
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < nthreads; i += 2 * width)
+		{
+			size_t mid = i + width < nthreads ? i + width : nthreads;
+			size_t hi = i + 2 * width < nthreads ? i + 2 * width : nthreads;
+			tasks[count++] = (struct sort_task) { array, src, dst, bounds[i], bounds[mid], bounds[hi] };
+		}
+		runTasks(mergeChunks, tasks, threads, count);
+
+		char* t = src;
+		src = dst;
+		dst = t;
+	}
+
+	if (src != base)
+		memcpy(base, src, n * size);
+
+	free(tmp);
+	free(bounds);
+	free(tasks);
+	free(threads);
+	return 0;
+}
+
+/// Map a primitive key to an unsigned integer with the same order, so that it can be sorted by its bytes.
+template <typename K, typename U> inline U radixKey(K key)
+{
+	U bits;
+	memcpy(&bits, &key, sizeof(U));
+	const U sign = (U)1 << (sizeof(U) * 8 - 1);
+
+	if (K(-1) > K(0))
+		return bits;
+	if (K(0.5) == K(0))
+		return bits ^ sign;
+	return (bits & sign) ? ~bits : bits ^ sign;
+}
+
+/**
+ * Sort @p n primitive keys at @p base with an LSD radix sort by bytes, without calling the comparator.
+ *
+ * Histograms of all bytes are counted in one pass, and passes over bytes that are the same in all keys are skipped.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+template <typename K, typename U> int radixSort(K* base, size_t n)
+{
+	K* tmp = (K*) malloc(n * sizeof(K));
+	size_t (*counts)[256] = (size_t (*)[256]) calloc(sizeof(K), sizeof(*counts));
+	if (tmp == NULL || counts == NULL)
+	{
+		free(tmp);
+		free(counts);
+		return -1;
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		U key = radixKey<K, U>(base[i]);
+		for (size_t d = 0; d < sizeof(K); d++)
+			counts[d][(key >> (8 * d)) & 0xFF]++;
+	}
+
+	K* src = base;
+	K* dst = tmp;
+	for (size_t d = 0; d < sizeof(K); d++)
+	{
+		if (counts[d][(radixKey<K, U>(base[0]) >> (8 * d)) & 0xFF] == n)
+			continue;
+
+		size_t offset = 0;
+		for (size_t c = 0; c < 256; c++)
+		{
+			size_t t = counts[d][c];
+			counts[d][c] = offset;
+			offset += t;
+		}
+
+		for (size_t i = 0; i < n; i++)
+			dst[counts[d][(radixKey<K, U>(src[i]) >> (8 * d)) & 0xFF]++] = src[i];
+
+		K* t = src;
+		src = dst;
+		dst = t;
+	}
+
+	if (src != base)
+		memcpy(base, src, n * sizeof(K));
+
+	free(tmp);
+	free(counts);
+	return 0;
+}
+
+/// Runs shorter than this on average are not worth merging, the whole array is sorted instead.
+#define SA_MIN_RUN 32
+
+/// Reverse @p n elements at @p base in place.
+void reverseElems(struct sorted_array* array, char* base, size_t n)
+{
+	size_t size = array->elem_size;
+	for (size_t i = 0, j = n - 1; i < j; i++, j--)
+	{
+		char* a = base + i * size;
+		char* b = base + j * size;
+		for (size_t k = 0; k < size; k++)
+		{
+			char t = a[k];
+			a[k] = b[k];
+			b[k] = t;
+		}
+	}
+}
+
+/**
+ * Sort @p n elements at @p base by merging the sorted runs already present in them.
+ *
+ * Non-descending runs are taken as they are, strictly descending runs are reversed, which keeps the sort stable.
+ * The runs are then merged pairwise in ceil(log(runs)) rounds, so an array with r runs is sorted in O(n log r).
+ * @return 0 on success, 1 if the runs are too short for merging them to pay off, -1 with errno set otherwise.
+ */
+int mergeRuns(struct sorted_array* array, char* base, size_t n)
+{
+	size_t size = array->elem_size;
+	size_t max_runs = n / SA_MIN_RUN + 1;
+	size_t* bounds = (size_t*) malloc((max_runs + 1) * sizeof(size_t));
+	if (bounds == NULL)
+		return -1;
+
+	size_t runs = 0;
+	bounds[0] = 0;
+	for (size_t lo = 0; lo < n; )
+	{
+		if (runs == max_runs)
+		{
+			free(bounds);
+			return 1;
+		}
+
+		size_t hi = lo + 1;
+		if (hi < n && array->compar(base + lo * size, base + hi * size) > 0)
+		{
+			while (hi + 1 < n && array->compar(base + hi * size, base + (hi + 1) * size) > 0)
+				hi++;
+			hi++;
+			reverseElems(array, base + lo * size, hi - lo);
+		}
+		else
+		{
+			while (hi < n && array->compar(base + (hi - 1) * size, base + hi * size) <= 0)
+				hi++;
+		}
+
+		bounds[++runs] = hi;
+		lo = hi;
+	}
+
+	if (runs == 1)
+	{
+		free(bounds);
+		return 0;
+	}
+
+	char* tmp = (char*) malloc(n * size);
+	if (tmp == NULL)
+	{
+		free(bounds);
+		return -1;
+	}
+
+	char* src = base;
+	char* dst = tmp;
+	for (size_t width = 1; width < runs; width *= 2)
+	{
+		for (size_t i = 0; i < runs; i += 2 * width)
+		{
+			size_t mid = i + width < runs ? i + width : runs;
+			size_t hi = i + 2 * width < runs ? i + 2 * width : runs;
+			struct sort_task task = { array, src, dst, bounds[i], bounds[mid], bounds[hi] };
+			mergeChunks(&task);
+		}
+
+		char* t = src;
+		src = dst;
+		dst = t;
+	}
+
+	if (src != base)
+		memcpy(base, src, n * size);
+
+	free(tmp);
+	free(bounds);
+	return 0;
+}
+
+/**
+ * Sort @p n elements of @p array at @p base.
+ *
+ * Elements forming long sorted runs are merged run by run. Otherwise primitive keys (see sakeytype()) are radix sorted,
+ * and large arrays are sorted in parallel if sathreads() allows it.
+ * Every sort, that needs memory, falls back to qsort() if it can't get it, so this one doesn't fail and leaves errno intact.
+ */
+void sortElems(struct sorted_array* array, char* base, size_t n)
+{
+	if (n < 2)
+		return;
+
+	int saved_errno = errno;
+	int sorted = mergeRuns(array, base, n);
+	if (sorted != 0)
+	{
+		switch (array->key_type)
+		{
+			case SA_KEY_INT32:	sorted = radixSort<int32_t, uint32_t>((int32_t*) base, n);	break;
+			case SA_KEY_INT64:	sorted = radixSort<int64_t, uint64_t>((int64_t*) base, n);	break;
+			case SA_KEY_FLOAT:	sorted = radixSort<float, uint32_t>((float*) base, n);		break;
+			case SA_KEY_DOUBLE:	sorted = radixSort<double, uint64_t>((double*) base, n);	break;
+			default:			break;
+		}
+	}
+
+	size_t nthreads = array->threads;
+	if (nthreads > n / SA_PAR_MIN)
+		nthreads = n / SA_PAR_MIN;
+	if (sorted != 0 && nthreads > 1)
+		sorted = parallelSort(array, base, n, nthreads);
+
+	if (sorted != 0)
+		qsort(base, n, array->elem_size, array->compar);
+	errno = saved_errno;
+}
+
+// ----------- Touched elements --------------
+
+/// Incremental resort is used only while touched elements make up at most 1 / SA_TOUCH_RATIO of the array.
+#define SA_TOUCH_RATIO 8
+
+/// Forget touched ranges, so that the next saresort() sorts the whole array.
+inline void touchAll(struct sorted_array* array)
+{
+	array->touched_n = 0;
+	array->touched_elems = 0;
+	array->touched_all = 1;
+}
+
+/// Start tracking touched elements anew after the array was sorted.
+inline void clearTouched(struct sorted_array* array)
+{
+	array->touched_n = 0;
+	array->touched_elems = 0;
+	array->touched_all = 0;
+}
+
+/// Remember elements [@p from, @p to) as touched, falling back to a full resort if there are too many of them.
+void addTouched(struct sorted_array* array, size_t from, size_t to)
+{
+	if (array->touched_all || from == to)
+		return;
+
+	size_t len = array->n + array->wbuf_n;
+	if (array->wbuf_n > 0 || (array->touched_elems + to - from) * SA_TOUCH_RATIO > len)
+	{
+		touchAll(array);
+		return;
+	}
+
+	if (array->touched_n > 0 && array->touched[2 * array->touched_n - 1] == from)
+	{
+		array->touched[2 * array->touched_n - 1] = to;
+		array->touched_elems += to - from;
+		return;
+	}
+
+	if (array->touched_n == array->touched_cap)
+	{
+		size_t cap = array->touched_cap ? array->touched_cap * 2 : 16;
+		size_t* p = (size_t*) realloc(array->touched, cap * 2 * sizeof(size_t));
+		if (p == NULL)
+		{
+			touchAll(array);
+			return;
+		}
+		array->touched = p;
+		array->touched_cap = cap;
+	}
+
+	array->touched[2 * array->touched_n] = from;
+	array->touched[2 * array->touched_n + 1] = to;
+	array->touched_n++;
+	array->touched_elems += to - from;
+}
+
+int cmpRanges(const void* a, const void* b)
+{
+	size_t x = *(const size_t*)a, y = *(const size_t*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Sort @p n elements at @p base, of which only the touched ones may be out of order.
+ *
+ * The touched elements are moved out and sorted, the rest is compacted in one forward pass
+ * and the sorted ones are merged back from the end, so d touched elements cost O(n + d log d).
+ * All elements are sorted if there is no memory for the touched ones.
+ */
+void resortTouched(struct sorted_array* array, char* base, size_t n)
+{
+	size_t size = array->elem_size;
+	size_t* ranges = array->touched;
+	size_t count = array->touched_n;
+
+	qsort(ranges, count, 2 * sizeof(size_t), cmpRanges);
+	size_t d = 0;
+	size_t k = 0;
+	for (size_t r = 0; r < count; r++)
+	{
+		size_t from = ranges[2 * r];
+		size_t to = ranges[2 * r + 1];
+		if (k > 0 && from <= ranges[2 * k - 1])
+		{
+			if (to > ranges[2 * k - 1])
+			{
+				d += to - ranges[2 * k - 1];
+				ranges[2 * k - 1] = to;
+			}
+			continue;
+		}
+		ranges[2 * k] = from;
+		ranges[2 * k + 1] = to;
+		d += to - from;
+		k++;
+	}
+
+	int saved_errno = errno;
+	char* dirty = (char*) malloc(d * size + 1);
+	if (dirty == NULL)
+	{
+		errno = saved_errno;
+		sortElems(array, base, n);
+		return;
+	}
+
+	char* out = base;
+	char* taken = dirty;
+	size_t prev = 0;
+	for (size_t r = 0; r < k; r++)
+	{
+		size_t from = ranges[2 * r];
+		size_t to = ranges[2 * r + 1];
+		memmove(out, base + prev * size, (from - prev) * size);
+		out += (from - prev) * size;
+		memcpy(taken, base + from * size, (to - from) * size);
+		taken += (to - from) * size;
+		prev = to;
+	}
+	memmove(out, base + prev * size, (n - prev) * size);
+
+	sortElems(array, dirty, d);
+	mergeInto(array, base, n - d, dirty, d);
+
+	free(dirty);
+}
+
+
+// ----------- Write buffer --------------
+
+/// Merge the write buffer into the main buffer in one linear pass.
+inline void flushPending(struct sorted_array* array)
+{
+	if (array->wbuf_n == 0)
+		return;
+
+	mergeBack(array, array->wbuf, array->wbuf_n);
+	array->wbuf_n = 0;
+}
+
+inline char* pendingElem(struct sorted_array* array, size_t index)
+{
+	return array->wbuf + index * array->elem_size;
+}
+
+/// Find the first element of the write buffer >= @p elem (or > @p elem if @p upper is set).
+size_t findPending(struct sorted_array* array, void* elem, int upper)
+{
+	size_t left = 0;
+	size_t right = array->wbuf_n;
+
+	while (left < right)
+	{
+		size_t center = (left + right) / 2;
+		int sign = array->compar(pendingElem(array, center), elem);
+		if (upper ? sign <= 0 : sign < 0)
+			left = center + 1;
+		else
+			right = center;
+	}
+	return left;
+}
+
+/**
+ * Put a copy of @p elem into the write buffer, merging the buffer into the main one when it is full.
+ *
+ * Only the small write buffer is shifted, so an insertion costs O(log n + wbuf_cap),
+ * plus the amortized O(n / wbuf_cap) of merges.
+ */
+void putPending(struct sorted_array* array, void* elem)
+{
+	size_t size = array->elem_size;
+	size_t place = findPending(array, elem, 1);
+
+	memmove(pendingElem(array, place + 1), pendingElem(array, place), (array->wbuf_n - place) * size);
+	memcpy(pendingElem(array, place), elem, size);
+	array->wbuf_n++;
+
+	if (array->wbuf_n == array->wbuf_cap)
+		flushPending(array);
+}
+
+/**
+ * Get the element with @p index in the merged order of the main buffer and the write buffer.
+ *
+ * Equal elements of the main buffer go first, as they will after a merge.
+ * The split between the two buffers is found by bisection in O(log wbuf_n).
+ */
+void* mergedElem(struct sorted_array* array, size_t index)
+{
+	if (array->wbuf_n == 0)
+		return getElem(array, index);
+
+	size_t lo = index > array->n ? index - array->n : 0;
+	size_t hi = index < array->wbuf_n ? index : array->wbuf_n;
+
+	while (lo < hi)
+	{
+		size_t j = (lo + hi) / 2;
+		if (array->compar(getElem(array, index - j - 1), pendingElem(array, j)) > 0)
+			lo = j + 1;
+		else
+			hi = j;
+	}
+
+	size_t i = index - lo;
+	if (i < array->n && (lo == array->wbuf_n || array->compar(getElem(array, i), pendingElem(array, lo)) <= 0))
+		return getElem(array, i);
+	return pendingElem(array, lo);
+}
+
+// ----------- File-backed arrays --------------
+
+/// Magic number opening a file of a sorted array.
+#define SA_FILE_MAGIC "SORTARR"
+
+/// Version of the file format; files of other versions are rejected.
+#define SA_FILE_VERSION 1
+
+/**
+ * Header of a file of a sorted array, followed by the elements.
+ *
+ * Fields are stored in the byte order of the machine that wrote the file.
+ * The header is 64 bytes long, so that the elements start on a cache line.
+ */
+struct sa_file_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t elem_size;
+	uint64_t n;
+	uint64_t reserved[4];
+};
+
+/// The mapping of a file-backed array.
+struct sa_file
+{
+	int fd;
+	char* map;
+	size_t bytes;
+	int writable;
+};
+
+inline struct sa_file_header* fileHeader(struct sorted_array* array)
+{
+	return (struct sa_file_header*) array->file->map;
+}
+
+/// Write the number of elements into the header of a writable file. The pages reach the file in the background or on msync().
+inline void storeCount(struct sorted_array* array)
+{
+	if (array->file->writable)
+		fileHeader(array)->n = array->n;
+}
+
+/// Unmap and close the file of @p array, storing the number of elements in it.
+void closeFile(struct sorted_array* array)
+{
+	storeCount(array);
+	munmap(array->file->map, array->file->bytes);
+	close(array->file->fd);
+	free(array->file);
+	array->file = NULL;
+}
+
+/**
+ * Change the capacity of a file-backed array to @p max_elems elements.
+ *
+ * A writable file is resized and remapped with mremap(), so the contents are neither copied nor read.
+ * A read-only array is mapped privately, and its pages past the end of the file can't be accessed,
+ * so it is copied to memory and detached from the file instead.
+ */
+int resizeFile(struct sorted_array* array, size_t max_elems)
+{
+	struct sa_file* file = array->file;
+	if (!file->writable)
+	{
+		struct sorted_array old = *array;
+		if (allocBuffer(array, max_elems * array->elem_size + 1) != 0)
+		{
+			*array = old;
+			return -1;
+		}
+		memcpy(array->buffer, old.buffer, array->n * array->elem_size);
+		array->file = NULL;
+		closeFile(&old);
+		array->max_elems = max_elems;
+		return 0;
+	}
+
+	size_t bytes = sizeof(struct sa_file_header) + max_elems * array->elem_size;
+	if (ftruncate(file->fd, bytes) != 0)
+		return -1;
+	void* p = mremap(file->map, file->bytes, bytes, MREMAP_MAYMOVE);
+	if (p == MAP_FAILED)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	file->map = (char*) p;
+	file->bytes = bytes;
+	array->buffer = file->map + sizeof(struct sa_file_header);
+	array->max_elems = max_elems;
+	return 0;
+}
+
+/**
+ * Check the header of a file of @p bytes bytes, mapped at @p map, for elements of @p elem_size bytes.
+ * @return 0 if the file is valid, -1 with errno set otherwise.
+ */
+int checkHeader(const char* map, size_t bytes, size_t elem_size)
+{
+	const struct sa_file_header* header = (const struct sa_file_header*) map;
+	if (bytes < sizeof(struct sa_file_header) || memcmp(header->magic, SA_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != SA_FILE_VERSION || header->header_size != sizeof(struct sa_file_header))
+	{
+		errno = EPROTO;
+		return -1;
+	}
+
+	if (header->elem_size != elem_size)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (header->n > (bytes - sizeof(struct sa_file_header)) / elem_size)
+	{
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+
+// ----------- Serialization --------------
+
+/// Magic number opening a serialized sorted array.
+#define SA_STREAM_MAGIC "SASTREAM"
+
+/// Version of the serialization format; streams of other versions are rejected.
+#define SA_STREAM_VERSION 1
+
+/// Bytes of elements the stream writer collects before writing a chunk.
+#define SA_STREAM_CHUNK ((size_t)1 << 16)
+
+/// The header count of a stream, that didn't know its length in advance.
+#define SA_STREAM_UNKNOWN UINT64_MAX
+
+/// At most this many elements are reserved for a header count, that can't be checked against the size of a file.
+#define SA_STREAM_RESERVE ((size_t)1 << 16)
+
+/**
+ * Header of a serialized sorted array.
+ *
+ * It is followed by chunks, each one made of a sa_chunk_header and its elements, and an empty chunk ends the stream.
+ * Fields are stored in the byte order of the machine that wrote the stream.
+ */
+struct sa_stream_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t elem_size;
+	uint64_t count;	///< Number of elements, or SA_STREAM_UNKNOWN
+};
+
+struct sa_chunk_header
+{
+	uint64_t count;
+	uint64_t checksum;	///< checksum() of the elements of the chunk
+};
+
+struct sa_writer
+{
+	FILE* out;
+	size_t elem_size;
+	char* buf;
+	size_t n;
+	size_t cap;
+};
+
+struct sa_reader
+{
+	FILE* in;
+	size_t elem_size;
+	uint64_t left;	///< Elements left in the current chunk
+	uint64_t checksum;	///< Running checksum of the current chunk
+	uint64_t expected;	///< Checksum stored for the current chunk
+	int end;
+};
+
+/// Initial value of checksum().
+#define SA_CHECKSUM_SEED 0xcbf29ce484222325ULL
+
+/**
+ * Continue a 64-bit FNV-1a checksum @p h over @p count elements of @p elem_size bytes, taking 8 bytes at a step.
+ *
+ * Steps restart at every element, so a chunk read piece by piece, at element boundaries, gets the same checksum.
+ * The checksum catches truncated and corrupted streams; it's not meant to resist deliberate tampering.
+ */
+uint64_t checksum(uint64_t h, const void* data, size_t count, size_t elem_size)
+{
+	const unsigned char* p = (const unsigned char*) data;
+	size_t step = elem_size % 8 == 0 ? count * elem_size : elem_size;
+	for (size_t left = count * elem_size; left > 0; left -= step)
+	{
+		size_t bytes = step;
+		for (; bytes >= 8; p += 8, bytes -= 8)
+		{
+			uint64_t w;
+			memcpy(&w, p, 8);
+			h = (h ^ w) * 0x100000001b3ULL;
+		}
+		for (; bytes > 0; p++, bytes--)
+			h = (h ^ *p) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/// Write @p bytes to @p out. @return 0 on success, -1 with errno set otherwise.
+int writeAll(FILE* out, const void* data, size_t bytes)
+{
+	if (bytes > 0 && fwrite(data, 1, bytes, out) != bytes)
+	{
+		if (errno == 0)
+			errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+/// Read exactly @p bytes from @p in. @return 0 on success, -1 with errno set otherwise; EBADMSG for a truncated stream.
+int readAll(FILE* in, void* data, size_t bytes)
+{
+	if (bytes > 0 && fread(data, 1, bytes, in) != bytes)
+	{
+		if (!ferror(in))
+			errno = EBADMSG;
+		else if (errno == 0)
+			errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+/// Get the number of bytes after the position of @p in, or (size_t)-1 if it's not a regular file.
+size_t streamRemaining(FILE* in)
+{
+	int saved_errno = errno;
+	struct stat st;
+	long pos = ftell(in);
+	size_t left = (size_t)-1;
+	if (pos >= 0 && fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= pos)
+		left = st.st_size - pos;
+	errno = saved_errno;
+	return left;
+}
+
+int writeStreamHeader(FILE* out, size_t elem_size, uint64_t count)
+{
+	struct sa_stream_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SA_STREAM_MAGIC, sizeof(header.magic));
+	header.version = SA_STREAM_VERSION;
+	header.elem_size = elem_size;
+	header.count = count;
+	return writeAll(out, &header, sizeof(header));
+}
+
+/// Check a stream header. @return 0 if it's valid, -1 with errno set otherwise.
+int checkStreamHeader(const struct sa_stream_header* header)
+{
+	if (memcmp(header->magic, SA_STREAM_MAGIC, sizeof(header->magic)) != 0 || 
+		header->version != SA_STREAM_VERSION || header->elem_size == 0)
+	{
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+/// Write a chunk of @p count elements of @p elem_size bytes. An empty chunk ends the stream.
+int writeChunk(FILE* out, const void* data, size_t count, size_t elem_size)
+{
+	struct sa_chunk_header chunk = { count, checksum(SA_CHECKSUM_SEED, data, count, elem_size) };
+	if (writeAll(out, &chunk, sizeof(chunk)) != 0)
+		return -1;
+	return writeAll(out, data, count * elem_size);
+}
+
+/**
+ * Read up to @p max elements from a stream into @p out, checking the checksum of every chunk at its end.
+ * @return The number of read elements, 0 at the end of the stream, or (size_t)-1 with errno set in case of an error.
+ */
+size_t readElems(struct sa_reader* r, void* out, size_t max)
+{
+	char* p = (char*) out;
+	size_t done = 0;
+	while (done < max && !r->end)
+	{
+		if (r->left == 0)
+		{
+			struct sa_chunk_header chunk;
+			if (readAll(r->in, &chunk, sizeof(chunk)) != 0)
+				return (size_t)-1;
+			if (chunk.count == 0)
+			{
+				r->end = 1;
+				break;
+			}
+			r->left = chunk.count;
+			r->expected = chunk.checksum;
+			r->checksum = SA_CHECKSUM_SEED;
+		}
+
+		size_t count = max - done < r->left ? max - done : r->left;
+		if (readAll(r->in, p, count * r->elem_size) != 0)
+			return (size_t)-1;
+		r->checksum = checksum(r->checksum, p, count, r->elem_size);
+		r->left -= count;
+		if (r->left == 0 && r->checksum != r->expected)
+		{
+			errno = EBADMSG;
+			return (size_t)-1;
+		}
+
+		p += count * r->elem_size;
+		done += count;
+	}
+	return done;
+}
+
+/// Check, that @p count elements at @p base are in order. @return Nonzero if they are.
+int isSorted(struct sorted_array* array, const char* base, size_t count)
+{
+	size_t size = array->elem_size;
+	for (size_t i = 1; i < count; i++)
+		if (array->compar(base + (i - 1) * size, base + i * size) > 0)
+			return 0;
+	return 1;
+}
+
+
+// ----------- Concurrent reads --------------
+
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#endif
+}
+
+/**
+ * A write section of a concurrent array, from construction to destruction.
+ *
+ * The sequence number is odd while the section runs, so readers overlapping it see it changed and retry.
+ */
+struct seq_writer
+{
+	struct sorted_array* array;
+
+	seq_writer(struct sorted_array* array) : array(array != NULL && array->concurrent ? array : NULL)
+	{
+		if (this->array == NULL)
+			return;
+		__atomic_store_n(&array->seq, array->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+
+	~seq_writer()
+	{
+		if (array != NULL)
+			__atomic_store_n(&array->seq, array->seq + 1, __ATOMIC_RELEASE);
+	}
+};
+
+/**
+ * Run @p read on a snapshot of a concurrent @p array until no write section overlaps it.
+ *
+ * The element count is loaded before the buffer pointer, and the writer publishes a grown buffer before the count
+ * that needs it, so the snapshot never reaches past the end of its buffer, even if its contents are torn.
+ * Replaced buffers are retired instead of freed, so a late reader still reads valid memory.
+ * errno is restored before every retry, so only the errors of the validated attempt are reported.
+ */
+template <typename R, typename Read> R readConsistent(struct sorted_array* array, Read read)
+{
+	int saved_errno = errno;
+	struct sorted_array view;
+	for (;;)
+	{
+		unsigned long seq;
+		while ((seq = __atomic_load_n(&array->seq, __ATOMIC_ACQUIRE)) & 1)
+			cpuRelax();
+
+		memcpy((void*)&view, array, sizeof(view));
+		view.n = __atomic_load_n(&array->n, __ATOMIC_ACQUIRE);
+		view.buffer = __atomic_load_n(&array->buffer, __ATOMIC_ACQUIRE);
+		view.concurrent = 0;
+
+		R res = read(&view);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&array->seq, __ATOMIC_RELAXED) == seq)
+			return res;
+		errno = saved_errno;
+	}
+}
+
+
+// ----------- Set algebra --------------
+
+/// Operations of mergeSets().
+enum set_op
+{
+	SET_UNION,
+	SET_INTERSECT,
+	SET_DIFF,
+	SET_SYMDIFF
+};
+
+/// Arrays at least this many times longer than the other operand are skipped through by galloping.
+#define SA_GALLOP_RATIO 32
+
+/**
+ * Find the first element >= @p key at or after @p pos, when the elements before it don't go to the result.
+ *
+ * Arrays of primitive keys are scanned with the SIMD count kernels a window at a time.
+ * Other arrays are stepped through one by one, or galloped through if @p gallop is set.
+ */
+size_t skipTo(struct sorted_array* array, size_t pos, const void* key, int gallop)
+{
+	if (gallop)
+		return gallopLeft(array, pos, key);
+
+	if (array->count_kernel != NULL && array->tab == NULL)
+	{
+		size_t window = SA_SIMD_WINDOW / array->elem_size;
+		while (pos < array->n)
+		{
+			size_t len = array->n - pos < window ? array->n - pos : window;
+			size_t count = array->count_kernel(flatElem(array, pos), len, key, 0);
+			pos += count;
+			if (count < len)
+				break;
+		}
+		return pos;
+	}
+
+	while (pos < array->n && array->compar(getElem(array, pos), key) < 0)
+		pos++;
+	return pos;
+}
+
+/**
+ * Merge sorted arrays @p a and @p b with the set operation @p op, treating them as multisets.
+ *
+ * An element occuring x times in @p a and y times in @p b occurs max(x, y) times in the union,
+ * min(x, y) times in the intersection, x - y times in the difference (if positive) and |x - y| times in the
+ * symmetric difference, as with std::set_union() and the others.
+ * @param out the buffer for the result, or NULL to only count the elements of the result.
+ * @return A number of elements in the result.
+ */
+size_t mergeSets(struct sorted_array* a, struct sorted_array* b, enum set_op op, char* out)
+{
+	size_t size = a->elem_size;
+	size_t i = 0, j = 0, count = 0;
+	int gallopA = a->n / SA_GALLOP_RATIO > b->n;
+	int gallopB = b->n / SA_GALLOP_RATIO > a->n;
+
+	#define EMIT(array, index) { if (out != NULL) memcpy(out + count * size, getElem(array, index), size); count++; }
+
+	while (i < a->n && j < b->n)
+	{
+		int sign = a->compar(getElem(a, i), getElem(b, j));
+		if (sign < 0)
+		{
+			if (op == SET_INTERSECT)
+				i = skipTo(a, i, getElem(b, j), gallopA);
+			else
+			{
+				EMIT(a, i);
+				i++;
+			}
+		}
+		else if (sign > 0)
+		{
+			if (op == SET_INTERSECT || op == SET_DIFF)
+				j = skipTo(b, j, getElem(a, i), gallopB);
+			else
+			{
+				EMIT(b, j);
+				j++;
+			}
+		}
+		else
+		{
+			if (op == SET_UNION || op == SET_INTERSECT)
+				EMIT(a, i);
+			i++;
+			j++;
+		}
+	}
+
+	if (op != SET_INTERSECT)
+		for (; i < a->n; i++)
+			EMIT(a, i);
+	if (op == SET_UNION || op == SET_SYMDIFF)
+		for (; j < b->n; j++)
+			EMIT(b, j);
+
+	#undef EMIT
+	return count;
+}
+
+/**
+ * Replace the contents of @p dst with the result of set operation @p op on @p a and @p b.
+ *
+ * Writes straight into the buffer of @p dst, growing it if needed.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+int setOperation(struct sorted_array* dst, struct sorted_array* a, struct sorted_array* b, enum set_op op)
+{
+	if (dst == NULL || a == NULL || b == NULL || dst == a || dst == b || 
+		a->elem_size != b->elem_size || dst->elem_size != a->elem_size)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(dst);
+
+	if (dst->tab != NULL)
+	{
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	flushPending(a);
+	flushPending(b);
+
+	// The old contents of dst are dropped only once the result is known to fit
+	size_t bound = op == SET_INTERSECT ? (a->n < b->n ? a->n : b->n) : op == SET_DIFF ? a->n : a->n + b->n;
+	size_t exact = bound > dst->max_elems && !dst->growable ? mergeSets(a, b, op, NULL) : bound;
+	if (replaceSpace(dst, exact) != 0)
+		return -1;
+
+	dst->wbuf_n = 0;
+	invalidateIndex(dst);
+	dst->n = mergeSets(a, b, op, (char*)dst->buffer);
+	return 0;
+}
+
+// ----------- Merge iterator --------------
+
+/// Check whether the current element of array @p a goes before the current element of array @p b. Ties go to the earlier array.
+inline int beats(struct sa_merge_iter* it, size_t a, size_t b)
+{
+	if (it->pos[a] >= it->arrays[a]->n)
+		return 0;
+	if (it->pos[b] >= it->arrays[b]->n)
+		return 1;
+
+	int sign = it->arrays[a]->compar(getElem(it->arrays[a], it->pos[a]), getElem(it->arrays[b], it->pos[b]));
+	return sign < 0 || (sign == 0 && a < b);
+}
+
+/// Play the matches of the subtree under @p node, storing the losers. @return The winner of the subtree.
+size_t playTree(struct sa_merge_iter* it, size_t node)
+{
+	if (node >= it->k)
+		return node - it->k;
+
+	size_t left = playTree(it, 2 * node);
+	size_t right = playTree(it, 2 * node + 1);
+	if (beats(it, left, right))
+	{
+		it->tree[node] = right;
+		return left;
+	}
+	it->tree[node] = left;
+	return right;
+}
+
+/// Advance the winner and replay the matches on its path to the root in O(log k).
+void replayTree(struct sa_merge_iter* it)
+{
+	size_t winner = it->tree[0];
+	it->pos[winner]++;
+
+	for (size_t node = (winner + it->k) / 2; node >= 1; node /= 2)
+	{
+		if (beats(it, it->tree[node], winner))
+		{
+			size_t t = it->tree[node];
+			it->tree[node] = winner;
+			winner = t;
+		}
+	}
+	it->tree[0] = winner;
+}
+
+void freeMerge(struct sa_merge_iter* it)
+{
+	free(it->arrays);
+	free(it->pos);
+	free(it->tree);
+}
+
+/// Set up a merge iterator over @p count arrays, that must have the same element size.
+int initMerge(struct sa_merge_iter* it, struct sorted_array** arrays, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		if (arrays[i] == NULL || arrays[i]->elem_size != arrays[0]->elem_size)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		flushPending(arrays[i]);
+	}
+
+	it->k = count;
+	it->arrays = (struct sorted_array**) malloc((count + 1) * sizeof(struct sorted_array*));
+	it->pos = (size_t*) calloc(count + 1, sizeof(size_t));
+	it->tree = (size_t*) calloc(count + 1, sizeof(size_t));
+	if (it->arrays == NULL || it->pos == NULL || it->tree == NULL)
+	{
+		freeMerge(it);
+		return -1;
+	}
+	memcpy(it->arrays, arrays, count * sizeof(struct sorted_array*));
+
+	if (count > 0)
+		it->tree[0] = playTree(it, 1);
+	return 0;
+}
+
+inline int mergeEnd(struct sa_merge_iter* it)
+{
+	return it->k == 0 || it->pos[it->tree[0]] >= it->arrays[it->tree[0]]->n;
+}
+
+inline void* mergeElem(struct sa_merge_iter* it)
+{
+	return getElem(it->arrays[it->tree[0]], it->pos[it->tree[0]]);
+}
+
+
+
+
+
+
+// ----------- External memory --------------
+
+/// Maximum number of runs merged in one pass
+#define SA_XMERGE_WAYS 64
+
+/// Default size of a block of an external array, which is read at once
+#define SA_XBLOCK_BYTES 65536
+
+struct sa_xbuilder
+{
+	char* path;
+	FILE* out;
+	struct sorted_array* run;	///< Elements of the run being collected, in no order
+	FILE** runs;	///< Sorted runs, saved by sasave() to unlinked files next to the output
+	size_t nruns;
+	size_t runs_cap;
+	size_t n;
+};
+
+struct sa_xarray
+{
+	int fd;
+	size_t elem_size;
+	size_t n;
+	size_t block_elems;
+	struct sorted_array* fences;	///< The first element of every block
+	struct sorted_array* block;	///< The last block read
+	size_t cached;	///< Number of the last block read, or (size_t)-1
+};
+
+/// Create an anonymous file for a run in the directory of @p path, so that runs take space where the output goes.
+FILE* tempRun(const char* path)
+{
+	char* name = (char*) malloc(strlen(path) + 16);
+	if (name == NULL)
+		return NULL;
+	sprintf(name, "%s.run.XXXXXX", path);
+
+	int fd = mkstemp(name);
+	if (fd < 0)
+	{
+		free(name);
+		return NULL;
+	}
+	unlink(name);
+	free(name);
+
+	FILE* f = fdopen(fd, "w+b");
+	if (f == NULL)
+		close(fd);
+	return f;
+}
+
+void closeRuns(FILE** runs, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		if (runs[i] != NULL)
+			fclose(runs[i]);
+}
+
+/// Sort the collected elements and save them as a new run.
+int flushRun(struct sa_xbuilder* b)
+{
+	if (b->nruns == b->runs_cap)
+	{
+		size_t cap = b->runs_cap ? b->runs_cap * 2 : 16;
+		FILE** p = (FILE**) realloc(b->runs, cap * sizeof(FILE*));
+		if (p == NULL)
+			return -1;
+		b->runs = p;
+		b->runs_cap = cap;
+	}
+
+	sortElems(b->run, (char*)b->run->buffer, b->run->n);
+	FILE* f = tempRun(b->path);
+	if (f == NULL)
+		return -1;
+	if (sasave(b->run, f) != 0)
+	{
+		fclose(f);
+		return -1;
+	}
+
+	b->runs[b->nruns++] = f;
+	b->run->n = 0;
+	return 0;
+}
+
+void freeWindows(struct sorted_array** wins, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		if (wins[i] != NULL)
+			sadelete(wins[i]);
+	free(wins);
+}
+
+/// Open a window of @p window elements over each of @p count runs, and fill it with their first elements.
+struct sorted_array** openWindows(FILE** runs, size_t count, size_t elem_size, size_t window, 
+	int (*compar)(const void* a, const void* b), struct sa_reader* readers)
+{
+	struct sorted_array** wins = (struct sorted_array**) calloc(count, sizeof(struct sorted_array*));
+	if (wins == NULL)
+		return NULL;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		struct sa_stream_header header;
+		rewind(runs[i]);
+		if (readAll(runs[i], &header, sizeof(header)) != 0 || checkStreamHeader(&header) != 0)
+		{
+			freeWindows(wins, count);
+			return NULL;
+		}
+		readers[i] = (struct sa_reader) { runs[i], elem_size, 0, 0, 0, 0 };
+
+		wins[i] = sanew(elem_size, window, compar);
+		size_t got = wins[i] != NULL ? readElems(&readers[i], wins[i]->buffer, window) : (size_t)-1;
+		if (got == (size_t)-1)
+		{
+			freeWindows(wins, count);
+			return NULL;
+		}
+		wins[i]->n = got;
+	}
+	return wins;
+}
+
+/**
+ * Merge @p count runs into @p w, or right into @p out, if @p w is NULL.
+ *
+ * Every run is read through a window of @p window elements, which is a sorted array of its own,
+ * so the loser tree of the merge iterator plays the matches between them.
+ */
+int mergeExternal(FILE** runs, size_t count, size_t elem_size, size_t window, 
+	int (*compar)(const void* a, const void* b), struct sa_writer* w, FILE* out)
+{
+	struct sa_reader* readers = (struct sa_reader*) malloc(count * sizeof(struct sa_reader));
+	if (readers == NULL)
+		return -1;
+
+	struct sorted_array** wins = openWindows(runs, count, elem_size, window, compar, readers);
+	struct sa_merge_iter it;
+	if (wins == NULL || initMerge(&it, wins, count) != 0)
+	{
+		if (wins != NULL)
+			freeWindows(wins, count);
+		free(readers);
+		return -1;
+	}
+
+	while (!mergeEnd(&it))
+	{
+		size_t r = it.tree[0];
+		struct sorted_array* win = wins[r];
+		void* elem = mergeElem(&it);
+		if ((w != NULL ? sawrput(w, elem, 1) : writeAll(out, elem, elem_size)) != 0)
+			break;
+
+		// Keep the written element in the first slot, so that advancing past it lands on the refilled ones
+		if (it.pos[r] + 1 == win->n)
+		{
+			memmove(win->buffer, elem, elem_size);
+			size_t got = readElems(&readers[r], (char*)win->buffer + elem_size, window - 1);
+			if (got == (size_t)-1)
+				break;
+			win->n = got + 1;
+			it.pos[r] = 0;
+		}
+		replayTree(&it);
+	}
+
+	int res = mergeEnd(&it) ? 0 : -1;
+	freeMerge(&it);
+	freeWindows(wins, count);
+	free(readers);
+	return res;
+}
+
+/// Merge the runs of @p b in passes of at most SA_XMERGE_WAYS runs, until the last pass can write the output.
+int mergePasses(struct sa_xbuilder* b, size_t window)
+{
+	size_t size = b->run->elem_size;
+	while (b->nruns > SA_XMERGE_WAYS)
+	{
+		size_t merged = 0;
+		for (size_t first = 0; first < b->nruns; first += SA_XMERGE_WAYS)
+		{
+			size_t count = b->nruns - first < SA_XMERGE_WAYS ? b->nruns - first : SA_XMERGE_WAYS;
+			FILE* f = tempRun(b->path);
+			if (f == NULL)
+				return -1;
+			struct sa_writer* w = sawropen(f, size);
+			if (w == NULL || mergeExternal(b->runs + first, count, size, window, b->run->compar, w, NULL) != 0)
+			{
+				if (w != NULL)
+					sawrclose(w);
+				fclose(f);
+				return -1;
+			}
+			if (sawrclose(w) != 0)
+			{
+				fclose(f);
+				return -1;
+			}
+
+			closeRuns(b->runs + first, count);
+			for (size_t i = first; i < first + count; i++)
+				b->runs[i] = NULL;
+			b->runs[merged++] = f;
+		}
+		b->nruns = merged;
+	}
+	return 0;
+}
+
+/// Write the header of a file of saopen() format with @p n elements.
+int writeFileHeader(FILE* out, size_t elem_size, size_t n)
+{
+	struct sa_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SA_FILE_MAGIC, sizeof(header.magic));
+	header.version = SA_FILE_VERSION;
+	header.header_size = sizeof(header);
+	header.elem_size = elem_size;
+	header.n = n;
+	return writeAll(out, &header, sizeof(header));
+}
+
+/// Read exactly @p bytes at @p offset of @p fd.
+int preadAll(int fd, void* buf, size_t bytes, off_t offset)
+{
+	char* p = (char*) buf;
+	while (bytes > 0)
+	{
+		ssize_t got = pread(fd, p, bytes, offset);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+			return -1;
+		if (got == 0)
+		{
+			errno = EBADMSG;
+			return -1;
+		}
+		p += got;
+		offset += got;
+		bytes -= got;
+	}
+	return 0;
+}
+
+inline off_t xoffset(struct sa_xarray* x, size_t index)
+{
+	return sizeof(struct sa_file_header) + (off_t)index * x->elem_size;
+}
+
+/// Read block @p b into the block cache, unless it is already there.
+int loadBlock(struct sa_xarray* x, size_t b)
+{
+	if (x->cached == b)
+		return 0;
+
+	size_t first = b * x->block_elems;
+	size_t count = x->n - first < x->block_elems ? x->n - first : x->block_elems;
+	x->cached = (size_t)-1;
+	if (preadAll(x->fd, x->block->buffer, count * x->elem_size, xoffset(x, first)) != 0)
+		return -1;
+	x->block->n = count;
+	x->cached = b;
+	return 0;
+}
+
+/**
+ * Find the first element >= @p elem, or > @p elem if @p right is set.
+ *
+ * The fences give the only block, that can hold it: the one before the first fence, that is not less than @p elem.
+ * If the element is not in that block, it starts the next one.
+ */
+size_t xsearch(struct sa_xarray* x, void* elem, int right)
+{
+	size_t fence = right ? findPlaceRight(x->fences, elem) : findPlaceLeft(x->fences, elem);
+	if (fence == 0)
+		return 0;
+
+	size_t b = fence - 1;
+	if (loadBlock(x, b) != 0)
+		return (size_t)-1;
+	return b * x->block_elems + (right ? findPlaceRight(x->block, elem) : findPlaceLeft(x->block, elem));
+}
+
+void freeXarray(struct sa_xarray* x)
+{
+	if (x->fences != NULL)
+		sadelete(x->fences);
+	if (x->block != NULL)
+		sadelete(x->block);
+	close(x->fd);
+	free(x);
+}
+
+
+
+// ----------- Sorted map --------------
+
+/// A sorted map: a flat sorted array of keys, and a buffer of values, where the value of the i-th key is the i-th one.
+struct sorted_map
+{
+	struct sorted_array* keys;
+	char* values;
+	size_t value_size;
+	size_t values_cap;
+};
+
+inline void* mapValue(struct sorted_map* map, size_t index)
+{
+	return map->values + index * map->value_size;
+}
+
+/// Grow the buffer of values to the capacity of the keys.
+int syncValues(struct sorted_map* map)
+{
+	size_t cap = map->keys->max_elems;
+	if (cap <= map->values_cap)
+		return 0;
+
+	size_t bytes = cap * map->value_size;
+	char* values = (char*) realloc(map->values, bytes ? bytes : 1);
+	if (values == NULL)
+		return -1;
+	map->values = values;
+	map->values_cap = cap;
+	return 0;
+}
+
+/// Find the index of @p key, or (size_t)-1 if there's no such key.
+size_t mapLocate(struct sorted_map* map, const void* key)
+{
+	struct sorted_array* keys = map->keys;
+	size_t place = findPlaceLeft(keys, (void*)key);
+	if (place < keys->n && cmp(keys, place, (void*)key) == 0)
+		return place;
+	return (size_t)-1;
+}
+
+
+
+// ----------- Shards --------------
+
+/// Shards of fewer than shard_elems / SA_SHARD_MERGE elements are merged into a neighbour.
+#define SA_SHARD_MERGE 8
+
+/// A shard: a sorted array owning keys from its bound up to the bound of the next shard.
+struct sa_shard
+{
+	struct sorted_array* array;
+	pthread_mutex_t lock;
+	size_t n;	///< Length of the array, readable without the lock
+};
+
+/**
+ * Shards in the order of their key ranges.
+ *
+ * Operations on elements hold @p layout for reading and lock only their shard, so they run in parallel on different shards.
+ * Splits and merges change the list of shards holding @p layout for writing.
+ */
+struct sa_shards
+{
+	struct sa_shard** shards;
+	char* bounds;	///< bounds[i] is the least key of shard i; bounds[0] is unused
+	size_t nshards;
+	size_t cap;
+
+	pthread_rwlock_t layout;
+	size_t elem_size;
+	size_t shard_elems;
+	int (*compar)(const void* a, const void* b);
+};
+
+inline char* shardBound(struct sa_shards* sh, size_t i)
+{
+	return sh->bounds + i * sh->elem_size;
+}
+
+/// Find the shard owning @p elem: the last one with a bound not greater than it.
+size_t locateShard(struct sa_shards* sh, const void* elem)
+{
+	size_t left = 0;
+	size_t right = sh->nshards;
+	while (left + 1 < right)
+	{
+		size_t center = (left + right) / 2;
+		if (sh->compar(shardBound(sh, center), elem) <= 0)
+			left = center;
+		else
+			right = center;
+	}
+	return left;
+}
+
+/// The number of elements in shards before shard @p s.
+size_t shardOffset(struct sa_shards* sh, size_t s)
+{
+	size_t offset = 0;
+	for (size_t i = 0; i < s; i++)
+		offset += __atomic_load_n(&sh->shards[i]->n, __ATOMIC_RELAXED);
+	return offset;
+}
+
+struct sa_shard* newShard(struct sa_shards* sh)
+{
+	struct sa_shard* shard = (struct sa_shard*) malloc(sizeof(struct sa_shard));
+	if (shard == NULL)
+		return NULL;
+
+	shard->array = sanew(sh->elem_size, SA_MIN_GROW, sh->compar);
+	if (shard->array == NULL)
+	{
+		free(shard);
+		return NULL;
+	}
+	sagrowable(shard->array, 1);
+	pthread_mutex_init(&shard->lock, NULL);
+	shard->n = 0;
+	return shard;
+}
+
+void freeShard(struct sa_shard* shard)
+{
+	pthread_mutex_destroy(&shard->lock);
+	sadelete(shard->array);
+	free(shard);
+}
+
+/**
+ * Split shard @p s in two halves. The list of shards must be locked for writing.
+ *
+ * Equal elements are never split between shards, so every key is owned by exactly one of them.
+ * @return 0 on success or if the shard can't be split, -1 with errno set otherwise.
+ */
+int splitShard(struct sa_shards* sh, size_t s)
+{
+	struct sorted_array* a = sh->shards[s]->array;
+	size_t n = a->n;
+	if (n <= sh->shard_elems)
+		return 0;
+
+	size_t mid = findPlaceRight(a, flatElem(a, n / 2 - 1));
+	if (mid == n)
+		mid = findPlaceLeft(a, flatElem(a, n / 2));
+	if (mid == 0)
+		return 0;
+
+	if (sh->nshards == sh->cap)
+	{
+		size_t cap = sh->cap * 2;
+		struct sa_shard** shards = (struct sa_shard**) realloc(sh->shards, cap * sizeof(struct sa_shard*));
+		if (shards == NULL)
+			return -1;
+		sh->shards = shards;
+		char* bounds = (char*) realloc(sh->bounds, cap * sh->elem_size);
+		if (bounds == NULL)
+			return -1;
+		sh->bounds = bounds;
+		sh->cap = cap;
+	}
+
+	struct sa_shard* upper = newShard(sh);
+	if (upper == NULL || ensureSpace(upper->array, n - mid) != 0)
+	{
+		if (upper != NULL)
+			freeShard(upper);
+		return -1;
+	}
+
+	memcpy(upper->array->buffer, flatElem(a, mid), (n - mid) * sh->elem_size);
+	upper->array->n = upper->n = n - mid;
+	a->n = sh->shards[s]->n = mid;
+	invalidateIndex(a);
+
+	memmove(sh->shards + s + 2, sh->shards + s + 1, (sh->nshards - s - 1) * sizeof(struct sa_shard*));
+	memmove(shardBound(sh, s + 2), shardBound(sh, s + 1), (sh->nshards - s - 1) * sh->elem_size);
+	sh->shards[s + 1] = upper;
+	memcpy(shardBound(sh, s + 1), upper->array->buffer, sh->elem_size);
+	sh->nshards++;
+	return 0;
+}
+
+/**
+ * Merge shard @p s into its neighbour, if it got too small. The list of shards must be locked for writing.
+ * @return 0 on success or if the shard is big enough, -1 with errno set otherwise.
+ */
+int mergeShard(struct sa_shards* sh, size_t s)
+{
+	if (sh->nshards < 2 || sh->shards[s]->n * SA_SHARD_MERGE >= sh->shard_elems)
+		return 0;
+
+	// The upper shard of the pair is appended to the lower one
+	size_t lo = s > 0 ? s - 1 : 0;
+	struct sorted_array* a = sh->shards[lo]->array;
+	struct sorted_array* b = sh->shards[lo + 1]->array;
+	if (ensureSpace(a, b->n) != 0)
+		return -1;
+
+	memcpy(flatElem(a, a->n), b->buffer, b->n * sh->elem_size);
+	a->n += b->n;
+	sh->shards[lo]->n = a->n;
+	invalidateIndex(a);
+
+	freeShard(sh->shards[lo + 1]);
+	memmove(sh->shards + lo + 1, sh->shards + lo + 2, (sh->nshards - lo - 2) * sizeof(struct sa_shard*));
+	memmove(shardBound(sh, lo + 1), shardBound(sh, lo + 2), (sh->nshards - lo - 2) * sh->elem_size);
+	sh->nshards--;
+	return 0;
+}
+
+/// Lock the list of shards for writing and split or merge the shard owning @p elem, if it is still needed.
+int rebalanceShards(struct sa_shards* sh, const void* elem)
+{
+	pthread_rwlock_wrlock(&sh->layout);
+	size_t s = locateShard(sh, elem);
+	int res = sh->shards[s]->n > sh->shard_elems ? splitShard(sh, s) : mergeShard(sh, s);
+	pthread_rwlock_unlock(&sh->layout);
+	return res;
+}
+
+
+// =================================  API funcs  =======================================
+/**
+ * @errors
+ * @b ENOMEM -- Failed to allocate memory, or the size of @p max_elems elements overflows size_t;\n
+ * @b ERANGE -- @p elem_size is not positive or @p max_elems is negative.
+ */
+struct sorted_array* sanew(ssize_t elem_size, ssize_t max_elems, int (*compar)(const void* a, const void* b))
+{
+	return sanew_ex(elem_size, max_elems, compar, NULL, 0);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p flags are unknown, or @p allocator lacks alloc or free, or is given with huge page flags;\n
+ * @b ENOMEM -- Failed to allocate memory, or the size of @p max_elems elements overflows size_t;\n
+ * @b ERANGE -- @p elem_size is not positive or @p max_elems is negative.
+ */
+struct sorted_array* sanew_ex(ssize_t elem_size, ssize_t max_elems, int (*compar)(const void* a, const void* b), 
+	const struct sa_allocator* allocator, int flags)
+{
+	if (elem_size <= 0 || max_elems < 0)
+	{
+		errno = ERANGE;
+		return NULL;
+	}
+
+	if ((size_t)max_elems > SIZE_MAX / elem_size)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	const int known = SA_ALLOC_ALIGNED | SA_ALLOC_HUGEPAGES | SA_ALLOC_HUGETLB;
+	if ((flags & ~known) != 0 || (allocator != NULL && 
+		(allocator->alloc == NULL || allocator->free == NULL || (flags & (SA_ALLOC_HUGEPAGES | SA_ALLOC_HUGETLB)))))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sa_allocator none = { NULL, NULL, NULL, NULL };
+	if (allocator == NULL)
+		allocator = &none;
+
+	struct sorted_array* array = (struct sorted_array*) allocWith(allocator, sizeof(struct sorted_array), alignof(struct sorted_array));
+	if (array == NULL)
+		return NULL;
+
+	array->allocator = *allocator;
+	array->alloc_flags = flags;
+	array->file = NULL;
+	if (allocBuffer(array, elem_size * max_elems) != 0)
+	{
+		freeWith(allocator, array, sizeof(struct sorted_array));
+		return NULL;
+	}
+
+	array->max_elems = max_elems;
+	array->elem_size = elem_size;
+	array->compar = compar;
+	array->growable = 0;
+
+	array->eytz = NULL;
+	array->eytz_rank = NULL;
+	array->eytz_cap = 0;
+	array->indexed = 0;
+	array->index_valid = 0;
+
+	array->key_type = SA_KEY_NONE;
+	array->count_kernel = NULL;
+
+	array->tab = NULL;
+	array->block_elems = 0;
+
+	array->wbuf = NULL;
+	array->wbuf_n = 0;
+	array->wbuf_cap = 0;
+
+	array->threads = 1;
+
+	array->touched = NULL;
+	array->touched_n = 0;
+	array->touched_cap = 0;
+	array->touched_elems = 0;
+	array->touched_all = 0;
+
+	array->seq = 0;
+	array->concurrent = 0;
+	array->retired = NULL;
+
+	array->n = 0;
+
+	return array;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL.
+ */
+int sagrowable(struct sorted_array* array, int growable)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	array->growable = growable != 0;
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL, or the index is enabled for a concurrent array.
+ */
+int saindex(struct sorted_array* array, int enable)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (enable && array->concurrent)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	array->indexed = enable != 0;
+	array->index_valid = 0;
+	if (!array->indexed)
+	{
+		free(array->eytz);
+		free(array->eytz_rank);
+		array->eytz = NULL;
+		array->eytz_rank = NULL;
+		array->eytz_cap = 0;
+	}
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL, @p type is unknown, or the size of @p type doesn't match the element size.
+ */
+int sakeytype(struct sorted_array* array, enum sa_key_type type)
+{
+	static const size_t sizes[] = { 0, sizeof(int32_t), sizeof(int64_t), sizeof(float), sizeof(double) };
+
+	if (array == NULL || type < SA_KEY_NONE || type > SA_KEY_DOUBLE || 
+		(type != SA_KEY_NONE && sizes[type] != array->elem_size))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	array->key_type = type;
+	array->count_kernel = selectKernel(type);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL, it is already blocked, concurrent or has a write buffer, or @p block_elems is less than 4;\n
+ * @b ENOMEM -- Failed to allocate memory.
+ */
+int sablocks(struct sorted_array* array, size_t block_elems)
+{
+	if (block_elems == 0 && array != NULL)
+	{
+		block_elems = SA_BLOCK_BYTES / array->elem_size;
+		if (block_elems < 8)
+			block_elems = 8;
+	}
+
+	if (array == NULL || array->tab != NULL || array->concurrent || array->wbuf_cap != 0 || block_elems < 4)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct sa_blocktab* tab = (struct sa_blocktab*) calloc(1, sizeof(struct sa_blocktab));
+	if (tab == NULL)
+		return -1;
+
+	tab->start = (size_t*) malloc(sizeof(size_t));
+	if (tab->start == NULL)
+	{
+		free(tab);
+		return -1;
+	}
+	tab->start[0] = 0;
+	tab->refs = 1;
+
+	array->tab = tab;
+	array->block_elems = block_elems;
+
+	// Fill blocks to 3/4, so that the first insertions don't split them at once
+	size_t fill = block_elems * 3 / 4;
+	for (size_t i = 0; i < array->n; i += fill)
+	{
+		struct sa_block* block = NULL;
+		if (growTable(array) != 0 || (block = newBlock(array)) == NULL)
+		{
+			freeBlocks(array);
+			return -1;
+		}
+
+		block->n = array->n - i < fill ? array->n - i : fill;
+		memcpy(block->data, flatElem(array, i), block->n * array->elem_size);
+		insertBlock(array, tab->nblocks, block);
+	}
+	updateStarts(array, 0);
+
+	freeBuffer(array);
+	array->buffer = NULL;
+	array->buf_bytes = 0;
+	array->buf_mapped = 0;
+	array->buf_borrowed = 0;
+	invalidateIndex(array);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b EOPNOTSUPP -- @p array is not blocked;\n
+ * @b ENOMEM -- Failed to allocate memory.
+ */
+struct sorted_array* sasnapshot(struct sorted_array* array)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (array->tab == NULL)
+	{
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	struct sorted_array* snap = (struct sorted_array*) allocWith(&array->allocator, 
+		sizeof(struct sorted_array), alignof(struct sorted_array));
+	if (snap == NULL)
+		return NULL;
+
+	// Everything but the shared block table is private to the snapshot
+	*snap = *array;
+	snap->eytz = NULL;
+	snap->eytz_rank = NULL;
+	snap->eytz_cap = 0;
+	snap->indexed = 0;
+	snap->index_valid = 0;
+	snap->touched = NULL;
+	snap->touched_n = 0;
+	snap->touched_cap = 0;
+	snap->touched_elems = 0;
+	snap->touched_all = 0;
+	__atomic_add_fetch(&array->tab->refs, 1, __ATOMIC_RELAXED);
+	return snap;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL, blocked or concurrent;\n
+ * @b ENOMEM -- Failed to allocate memory.
+ */
+int sawbuffer(struct sorted_array* array, size_t count)
+{
+	if (array == NULL || array->tab != NULL || array->concurrent)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	flushPending(array);
+	if (count == 0)
+	{
+		free(array->wbuf);
+		array->wbuf = NULL;
+		array->wbuf_cap = 0;
+		return 0;
+	}
+
+	// Pending elements are flushed into the main buffer
+	if (ownBuffer(array) != 0)
+		return -1;
+	char* wbuf = (char*) realloc(array->wbuf, count * array->elem_size);
+	if (wbuf == NULL)
+		return -1;
+
+	array->wbuf = wbuf;
+	array->wbuf_cap = count;
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL.
+ */
+int saflush(struct sorted_array* array)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	flushPending(array);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL, or it is blocked, indexed, file-backed, loaded by saloadmem() or has a write buffer.
+ */
+int saconcurrent(struct sorted_array* array, int enable)
+{
+	if (array == NULL || (enable && (array->tab != NULL || array->indexed || array->wbuf_cap != 0 || 
+		array->file != NULL || array->buf_borrowed)))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	array->concurrent = enable != 0;
+	if (!array->concurrent)
+		freeRetired(array);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b ENOMEM -- Failed to allocate memory, or the size of @p count elements overflows size_t.
+ */
+int sareserve(struct sorted_array* array, size_t count)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(array);
+
+	if (count <= array->max_elems)
+		return 0;
+
+	return resizeBuffer(array, count);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b EOPNOTSUPP -- @p array is concurrent;\n
+ * @b ENOMEM -- Failed to allocate memory.
+ */
+int sashrink(struct sorted_array* array)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	// A reader may still hold a count, that doesn't fit in a shrunk buffer
+	if (array->concurrent)
+	{
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	if (array->n + array->wbuf_n == array->max_elems)
+		return 0;
+
+	return resizeBuffer(array, array->n + array->wbuf_n);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL.
+ */
+void sadelete(struct sorted_array* array)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return;
+	}
+
+	if (array->file != NULL)
+		flushPending(array);
+	freeBuffer(array);
+	freeBlocks(array);
+	free(array->wbuf);
+	free(array->touched);
+	freeRetired(array);
+	free(array->eytz);
+	free(array->eytz_rank);
+	struct sa_allocator allocator = array->allocator;
+	freeWith(&allocator, array, sizeof(struct sorted_array));
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p path or @p compar is NULL, @p elem_size is not positive, @p flags are unknown,
+ * or the file stores elements of another size;\n
+ * @b EPROTO -- The file is not a sorted array of this format version;\n
+ * @b ENOMEM -- Failed to allocate memory;\n
+ * and errors of open(), fstat(), ftruncate() and mmap().
+ */
+struct sorted_array* saopen(const char* path, ssize_t elem_size, ssize_t max_elems, 
+	int (*compar)(const void* a, const void* b), int flags)
+{
+	if (path == NULL || compar == NULL || elem_size <= 0 || max_elems < 0 ||
+		(flags & ~(SA_OPEN_WRITE | SA_OPEN_CREATE)) != 0 || ((flags & SA_OPEN_CREATE) && !(flags & SA_OPEN_WRITE)))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	int saved_errno = errno;
+	int writable = (flags & SA_OPEN_WRITE) != 0;
+	int fd = open(path, writable ? O_RDWR : O_RDONLY);
+	int created = 0;
+	if (fd < 0 && errno == ENOENT && (flags & SA_OPEN_CREATE))
+	{
+		errno = saved_errno;
+		fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+		created = 1;
+	}
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	size_t bytes = sizeof(struct sa_file_header) + max_elems * elem_size;
+	if ((created && ftruncate(fd, bytes) != 0) || (!created && fstat(fd, &st) != 0))
+	{
+		close(fd);
+		return NULL;
+	}
+	if (!created)
+		bytes = st.st_size;
+
+	// Read-only arrays are mapped privately: the pages are shared with the page cache until changed, and changes stay in the process
+	void* map = bytes == 0 ? MAP_FAILED : 
+		mmap(NULL, bytes, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		if (bytes == 0)
+			errno = EPROTO;
+		close(fd);
+		return NULL;
+	}
+
+	struct sa_file_header* header = (struct sa_file_header*) map;
+	if (created)
+	{
+		memcpy(header->magic, SA_FILE_MAGIC, sizeof(header->magic));
+		header->version = SA_FILE_VERSION;
+		header->header_size = sizeof(struct sa_file_header);
+		header->elem_size = elem_size;
+		header->n = 0;
+	}
+
+	struct sa_file* file = (struct sa_file*) malloc(sizeof(struct sa_file));
+	struct sorted_array* array = NULL;
+	if (checkHeader((const char*)map, bytes, elem_size) != 0 || file == NULL || (array = sanew(elem_size, 0, compar)) == NULL)
+	{
+		free(file);
+		munmap(map, bytes);
+		close(fd);
+		return NULL;
+	}
+
+	*file = (struct sa_file) { fd, (char*) map, bytes, writable };
+	freeBuffer(array);
+	array->file = file;
+	array->buffer = file->map + sizeof(struct sa_file_header);
+	array->buf_bytes = 0;
+	array->buf_mapped = 0;
+	array->max_elems = (bytes - sizeof(struct sa_file_header)) / elem_size;
+	array->n = header->n;
+	return array;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b EROFS -- @p array is opened read-only;\n
+ * @b EOPNOTSUPP -- @p array is not file-backed;\n
+ * and errors of msync().
+ */
+int sasync(struct sorted_array* array)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (array->file == NULL)
+	{
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	if (!array->file->writable)
+	{
+		errno = EROFS;
+		return -1;
+	}
+
+	flushPending(array);
+	storeCount(array);
+	return msync(array->file->map, array->file->bytes, MS_SYNC);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array or @p out is NULL;\n
+ * and errors of writing to @p out.
+ */
+int sasave(struct sorted_array* array, FILE* out)
+{
+	if (array == NULL || out == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	flushPending(array);
+	if (writeStreamHeader(out, array->elem_size, array->n) != 0)
+		return -1;
+
+	// Every block of a blocked array becomes a chunk
+	if (array->tab == NULL && array->n > 0)
+	{
+		if (writeChunk(out, array->buffer, array->n, array->elem_size) != 0)
+			return -1;
+	}
+	else if (array->tab != NULL)
+	{
+		for (size_t b = 0; b < array->tab->nblocks; b++)
+			if (writeChunk(out, array->tab->blocks[b]->data, array->tab->blocks[b]->n, array->elem_size) != 0)
+				return -1;
+	}
+
+	if (writeChunk(out, NULL, 0, array->elem_size) != 0 || fflush(out) != 0)
+		return -1;
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p in or @p compar is NULL;\n
+ * @b EPROTO -- The stream is not a sorted array of this format version;\n
+ * @b EBADMSG -- The stream is truncated or corrupted;\n
+ * @b ENOMEM -- Failed to allocate memory;\n
+ * and errors of reading from @p in.
+ */
+struct sorted_array* saload(FILE* in, int (*compar)(const void* a, const void* b))
+{
+	if (in == NULL || compar == NULL)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sa_stream_header header;
+	if (readAll(in, &header, sizeof(header)) != 0 || checkStreamHeader(&header) != 0)
+		return NULL;
+
+	// The count isn't trusted before the chunks are checked: it must fit in the rest of a file, and is capped otherwise
+	size_t reserve = 0;
+	if (header.count != SA_STREAM_UNKNOWN)
+	{
+		size_t left = streamRemaining(in);
+		if (left != (size_t)-1 && header.count > left / header.elem_size)
+		{
+			errno = EBADMSG;
+			return NULL;
+		}
+		reserve = left != (size_t)-1 || header.count < SA_STREAM_RESERVE ? header.count : SA_STREAM_RESERVE;
+	}
+	struct sorted_array* array = sanew(header.elem_size, reserve, compar);
+	if (array == NULL)
+		return NULL;
+
+	// Elements are read straight into the buffer, chunk by chunk
+	struct sa_reader r = { in, header.elem_size, 0, 0, 0, 0 };
+	int sorted = 1;
+	array->growable = 1;
+	for (;;)
+	{
+		if (array->n == array->max_elems && ensureSpace(array, 1) != 0)
+			break;
+
+		size_t from = array->n;
+		size_t got = readElems(&r, flatElem(array, from), array->max_elems - from);
+		if (got == (size_t)-1 || got == 0)
+			break;
+
+		array->n += got;
+		if (sorted)
+			sorted = isSorted(array, (char*)flatElem(array, from > 0 ? from - 1 : 0), array->n - (from > 0 ? from - 1 : 0));
+	}
+	array->growable = 0;
+
+	if (!r.end || (header.count != SA_STREAM_UNKNOWN && header.count != array->n))
+	{
+		if (r.end)
+			errno = EBADMSG;
+		sadelete(array);
+		return NULL;
+	}
+
+	if (!sorted)
+		sortElems(array, (char*)array->buffer, array->n);
+	return array;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p data or @p compar is NULL;\n
+ * @b EPROTO -- The data is not a sorted array of this format version;\n
+ * @b EBADMSG -- The data is truncated or corrupted;\n
+ * @b ENOMEM -- Failed to allocate memory.
+ */
+struct sorted_array* saloadmem(void* data, size_t bytes, int (*compar)(const void* a, const void* b))
+{
+	if (data == NULL || compar == NULL)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sa_stream_header header;
+	if (bytes < sizeof(header))
+	{
+		errno = EBADMSG;
+		return NULL;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (checkStreamHeader(&header) != 0)
+		return NULL;
+
+	// The first pass validates all chunks and counts the elements
+	char* p = (char*)data + sizeof(header);
+	char* end = (char*)data + bytes;
+	char* first = NULL;
+	size_t size = header.elem_size;
+	size_t total = 0;
+	size_t chunks = 0;
+	for (;;)
+	{
+		struct sa_chunk_header chunk;
+		if ((size_t)(end - p) < sizeof(chunk))
+		{
+			errno = EBADMSG;
+			return NULL;
+		}
+		memcpy(&chunk, p, sizeof(chunk));
+		p += sizeof(chunk);
+		if (chunk.count == 0)
+			break;
+
+		if (chunk.count > (size_t)(end - p) / size || chunk.checksum != checksum(SA_CHECKSUM_SEED, p, chunk.count, size))
+		{
+			errno = EBADMSG;
+			return NULL;
+		}
+		if (first == NULL)
+			first = p;
+		p += chunk.count * size;
+		total += chunk.count;
+		chunks++;
+	}
+
+	if (header.count != SA_STREAM_UNKNOWN && header.count != total)
+	{
+		errno = EBADMSG;
+		return NULL;
+	}
+
+	struct sorted_array* array = sanew(size, 0, compar);
+	if (array == NULL)
+		return NULL;
+
+	if (chunks == 1 && isSorted(array, first, total))
+	{
+		freeBuffer(array);
+		array->buffer = first;
+		array->buf_bytes = 0;
+		array->buf_mapped = 0;
+		array->buf_borrowed = 1;
+		array->max_elems = array->n = total;
+		return array;
+	}
+
+	if (resizeBuffer(array, total) != 0)
+	{
+		sadelete(array);
+		return NULL;
+	}
+
+	p = (char*)data + sizeof(header);
+	for (size_t c = 0; c < chunks; c++)
+	{
+		struct sa_chunk_header chunk;
+		memcpy(&chunk, p, sizeof(chunk));
+		p += sizeof(chunk);
+		memcpy(flatElem(array, array->n), p, chunk.count * size);
+		p += chunk.count * size;
+		array->n += chunk.count;
+	}
+
+	if (!isSorted(array, (char*)array->buffer, array->n))
+		sortElems(array, (char*)array->buffer, array->n);
+	return array;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b ERANGE -- @p index is out of range.
+ */
+void* saget(struct sorted_array* array, size_t index)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (array->concurrent)
+		return readConsistent<void*>(array, [=](struct sorted_array* view) { return saget(view, index); });
+
+	if (index >= array->n + array->wbuf_n)
+	{
+		errno = ERANGE;
+		return NULL;
+	}
+
+	return mergedElem(array, index);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL, or @p out is NULL while the range is not empty;\n
+ * @b ERANGE -- @p from is greater than @p to, or @p to is greater than the length of the array.
+ */
+int saread(struct sorted_array* array, size_t from, size_t to, void* out)
+{
+	if (array == NULL || (out == NULL && from != to))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (array->concurrent)
+		return readConsistent<int>(array, [=](struct sorted_array* view) { return saread(view, from, to, out); });
+
+	if (from > to || to > array->n + array->wbuf_n)
+	{
+		errno = ERANGE;
+		return -1;
+	}
+
+	size_t size = array->elem_size;
+	if (array->tab == NULL && array->wbuf_n == 0)
+		memcpy(out, flatElem(array, from), (to - from) * size);
+	else
+		for (size_t i = from; i < to; i++)
+			memcpy((char*)out + (i - from) * size, mergedElem(array, i), size);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b ENOBUFS -- Maximum number of stored elements is reached;\n
+ * @b ENOMEM -- Failed to grow a growable array, or to copy the elements of saloadmem().
+ */
+int saput(struct sorted_array* array, void* elem)
+{
+	if (array == NULL || elem == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(array);
+	
+	if (ensureSpace(array, 1) != 0 || ownBuffer(array) != 0)
+		return -1;
+
+	if (array->wbuf_cap != 0)
+	{
+		putPending(array, elem);
+		return 0;
+	}
+
+	if (array->tab != NULL)
+	{
+		if (blockInsert(array, elem) != 0)
+			return -1;
+		array->n++;
+		invalidateIndex(array);
+		return 0;
+	}
+
+	size_t place = findPlaceRight(array, elem);
+	shiftRight(array, place, array->elem_size);
+	memcpy(flatElem(array, place), elem, array->elem_size);
+	array->n++;
+	invalidateIndex(array);
+
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL, or @p elems is NULL while @p count is not zero;\n
+ * @b ENOBUFS -- There is no space for @p count more elements;\n
+ * @b ENOMEM -- Failed to allocate memory for sorting the batch, to grow a growable array, or to copy the elements of saloadmem().
+ */
+int saputn(struct sorted_array* array, void* elems, size_t count)
+{
+	if (array == NULL || (elems == NULL && count != 0))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(array);
+
+	if (ensureSpace(array, count) != 0)
+		return -1;
+
+	if (count == 0)
+		return 0;
+
+	if (ownBuffer(array) != 0)
+		return -1;
+	flushPending(array);
+	char* batch = (char*) malloc(count * array->elem_size);
+	if (batch == NULL)
+		return -1;
+
+	memcpy(batch, elems, count * array->elem_size);
+	qsort(batch, count, array->elem_size, array->compar);
+
+	if (array->tab != NULL)
+	{
+		invalidateIndex(array);
+		for (size_t i = 0; i < count; i++, array->n++)
+		{
+			if (blockInsert(array, batch + i * array->elem_size) != 0)
+			{
+				free(batch);
+				return -1;
+			}
+		}
+	}
+	else
+		mergeBack(array, batch, count);
+
+	free(batch);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b ENOMEM -- Failed to copy blocks shared with a snapshot, or the elements of saloadmem();\n
+ * @b ERANGE -- @p index is out of range.
+ */
+int sarm(struct sorted_array* array, size_t index)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(array);
+
+	if (index >= array->n + array->wbuf_n)
+	{
+		errno = ERANGE;
+		return -1;
+	}
+
+	if (ownBuffer(array) != 0)
+		return -1;
+	flushPending(array);
+	if (array->tab != NULL && blockRemoveRange(array, index, index + 1) != 0)
+		return -1;
+	if (array->tab == NULL)
+		shifLeft(array, index, array->elem_size);
+	array->n--;
+	invalidateIndex(array);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array or @p elem is NULL;\n
+ * @b ENOMEM -- Failed to copy blocks shared with a snapshot, or the elements of saloadmem().
+ */
+int sarmall(struct sorted_array* array, void* elem)
+{
+	if (array == NULL || elem == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(array);
+
+	if (ownBuffer(array) != 0)
+		return -1;
+	flushPending(array);
+	size_t left = findPlaceLeft(array, elem);
+	size_t right = findPlaceRight(array, elem);
+
+	if (array->tab != NULL && blockRemoveRange(array, left, right) != 0)
+		return -1;
+	if (array->tab == NULL)
+		shifLeft(array, left, (right - left) * array->elem_size);
+	array->n -= right - left;
+	invalidateIndex(array);
+
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array or @p pred is NULL;\n
+ * @b ENOMEM -- Failed to copy blocks shared with a snapshot, or the elements of saloadmem().
+ */
+int sarmif(struct sorted_array* array, int (*pred)(void* elem, void* context), void* context)
+{
+	if (array == NULL || pred == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(array);
+
+	if (ownBuffer(array) != 0)
+		return -1;
+	flushPending(array);
+	invalidateIndex(array);
+	if (array->tab != NULL)
+	{
+		size_t removed = blockRemoveIf(array, pred, context);
+		if (removed == (size_t)-1)
+			return -1;
+		array->n -= removed;
+		return 0;
+	}
+
+	// Kept elements are moved by whole runs, every one at most once, and pred is called once per element
+	size_t size = array->elem_size;
+	size_t w = 0;
+	size_t run = 0;
+	for (size_t r = 0; r <= array->n; r++)
+	{
+		if (r < array->n && !pred(flatElem(array, r), context))
+			continue;
+
+		if (w != run)
+			memmove(flatElem(array, w), flatElem(array, run), (r - run) * size);
+		w += r - run;
+		run = r + 1;
+	}
+
+	array->n = w;
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b ENOMEM -- Failed to copy blocks shared with a snapshot, or the elements of saloadmem();\n
+ * @b ERANGE -- @p from is greater than @p to, or @p to is greater than the length of the array.
+ */
+int sarmrange(struct sorted_array* array, size_t from, size_t to)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(array);
+
+	if (from > to || to > array->n + array->wbuf_n)
+	{
+		errno = ERANGE;
+		return -1;
+	}
+
+	if (ownBuffer(array) != 0)
+		return -1;
+	flushPending(array);
+	if (array->tab != NULL && blockRemoveRange(array, from, to) != 0)
+		return -1;
+	if (array->tab == NULL)
+		shifLeft(array, from, (to - from) * array->elem_size);
+	array->n -= to - from;
+	invalidateIndex(array);
+
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL.
+ */
+size_t salen(struct sorted_array* array)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return (size_t) -1;
+	}
+
+	if (array->concurrent)
+		return readConsistent<size_t>(array, [](struct sorted_array* view) { return salen(view); });
+
+	return array -> n + array -> wbuf_n;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array or @p elem is NULL;\n
+ * @b ENOENT -- there is no such element in the array.
+ */
+size_t safind(struct sorted_array* array, void* elem)
+{
+	if (array == NULL || elem == NULL)
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	if (array->concurrent)
+		return readConsistent<size_t>(array, [=](struct sorted_array* view) { return safind(view, elem); });
+
+	if (array->n + array->wbuf_n == 0)
+	{
+		errno = ENOENT;
+		return (size_t)-1;
+	}
+
+	ensureIndex(array);
+	size_t place = findPlaceLeft(array, elem);
+	size_t pending = findPending(array, elem, 0);
+
+	// Elements less than elem in both buffers precede the first occurence
+	if ((place < array->n && cmp(array, place, elem) == 0) || 
+		(pending < array->wbuf_n && array->compar(pendingElem(array, pending), elem) == 0))
+		return place + pending;
+	else
+	{
+		errno = ENOENT;
+		return (size_t)-1;
+	}
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL, or @p keys or @p out_indices is NULL while @p count is not zero.
+ */
+size_t safindn(struct sorted_array* array, void* keys, size_t count, size_t* out_indices)
+{
+	if (array == NULL || (count != 0 && (keys == NULL || out_indices == NULL)))
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	if (array->concurrent)
+		return readConsistent<size_t>(array, [=](struct sorted_array* view) { return safindn(view, keys, count, out_indices); });
+
+	flushPending(array);
+	const char* k = (const char*) keys;
+	size_t size = array->elem_size;
+
+	int sorted = 1;
+	for (size_t i = 1; i < count && sorted; i++)
+		sorted = array->compar(k + (i - 1) * size, k + i * size) <= 0;
+
+	if (array->n == 0)
+		for (size_t i = 0; i < count; i++)
+			out_indices[i] = 0;
+	else if (sorted)
+		lowerBoundsSweep(array, k, count, out_indices);
+	else if (array->tab != NULL)
+		for (size_t i = 0; i < count; i++)
+			out_indices[i] = findPlaceLeft(array, (void*)(k + i * size));
+	else
+		lowerBoundsLockstep(array, k, count, out_indices);
+
+	size_t found = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t place = out_indices[i];
+		if (place < array->n && array->compar(getElem(array, place), k + i * size) == 0)
+			found++;
+		else
+			out_indices[i] = (size_t)-1;
+	}
+	return found;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- Any of the arrays is NULL, @p dst is the same as @p a or @p b, or element sizes differ;\n
+ * @b EOPNOTSUPP -- @p dst is blocked;\n
+ * @b ENOBUFS -- The result doesn't fit in @p dst;\n
+ * @b ENOMEM -- Failed to grow @p dst.
+ */
+int saunion(struct sorted_array* dst, struct sorted_array* a, struct sorted_array* b)
+{
+	return setOperation(dst, a, b, SET_UNION);
+}
+
+/// @errors The same as for saunion().
+int saintersect(struct sorted_array* dst, struct sorted_array* a, struct sorted_array* b)
+{
+	return setOperation(dst, a, b, SET_INTERSECT);
+}
+
+/// @errors The same as for saunion().
+int sadiff(struct sorted_array* dst, struct sorted_array* a, struct sorted_array* b)
+{
+	return setOperation(dst, a, b, SET_DIFF);
+}
+
+/// @errors The same as for saunion().
+int sasymdiff(struct sorted_array* dst, struct sorted_array* a, struct sorted_array* b)
+{
+	return setOperation(dst, a, b, SET_SYMDIFF);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p a or @p b is NULL, or their element sizes differ.
+ */
+size_t saintersectcount(struct sorted_array* a, struct sorted_array* b)
+{
+	if (a == NULL || b == NULL || a->elem_size != b->elem_size)
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	flushPending(a);
+	flushPending(b);
+	return mergeSets(a, b, SET_INTERSECT, NULL);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p dst or @p arrays is NULL, one of @p arrays is NULL or @p dst, or element sizes differ;\n
+ * @b EOPNOTSUPP -- @p dst is blocked;\n
+ * @b ENOBUFS -- The result doesn't fit in @p dst;\n
+ * @b ENOMEM -- Failed to allocate memory.
+ */
+int samerge(struct sorted_array* dst, struct sorted_array** arrays, size_t count)
+{
+	if (dst == NULL || (arrays == NULL && count != 0))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(dst);
+
+	size_t total = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (arrays[i] == dst || arrays[i] == NULL || arrays[i]->elem_size != dst->elem_size)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		total += arrays[i]->n + arrays[i]->wbuf_n;
+	}
+
+	if (dst->tab != NULL)
+	{
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	struct sa_merge_iter it;
+	if (initMerge(&it, arrays, count) != 0)
+		return -1;
+
+	if (replaceSpace(dst, total) != 0)
+	{
+		freeMerge(&it);
+		return -1;
+	}
+	dst->n = 0;
+	dst->wbuf_n = 0;
+	invalidateIndex(dst);
+
+	for (; !mergeEnd(&it); replayTree(&it))
+		memcpy(flatElem(dst, dst->n++), mergeElem(&it), dst->elem_size);
+
+	freeMerge(&it);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array or @p elem is NULL.
+ */
+size_t salower(struct sorted_array* array, void* elem)
+{
+	if (array == NULL || elem == NULL)
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	if (array->concurrent)
+		return readConsistent<size_t>(array, [=](struct sorted_array* view) { return salower(view, elem); });
+
+	ensureIndex(array);
+	return findPlaceLeft(array, elem) + findPending(array, elem, 0);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array or @p elem is NULL.
+ */
+size_t saupper(struct sorted_array* array, void* elem)
+{
+	if (array == NULL || elem == NULL)
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	if (array->concurrent)
+		return readConsistent<size_t>(array, [=](struct sorted_array* view) { return saupper(view, elem); });
+
+	ensureIndex(array);
+	return findPlaceRight(array, elem) + findPending(array, elem, 1);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array, @p lo, @p hi, @p begin or @p end is NULL.
+ */
+int sarange(struct sorted_array* array, void* lo, void* hi, size_t* begin, size_t* end)
+{
+	if (array == NULL || lo == NULL || hi == NULL || begin == NULL || end == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (array->concurrent)
+		return readConsistent<int>(array, [=](struct sorted_array* view) { return sarange(view, lo, hi, begin, end); });
+
+	ensureIndex(array);
+	*begin = findPlaceLeft(array, lo) + findPending(array, lo, 0);
+	*end = findPlaceRight(array, hi) + findPending(array, hi, 1);
+	if (*end < *begin)
+		*end = *begin;
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array or @p elem is NULL.
+ */
+size_t sacount(struct sorted_array* array, void* elem)
+{
+	size_t begin, end;
+	if (sarange(array, elem, elem, &begin, &end) != 0)
+		return (size_t)-1;
+	return end - begin;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b EOPNOTSUPP -- @p array is blocked.
+ */
+void* sadata(struct sorted_array* array)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (array->tab != NULL)
+	{
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	flushPending(array);
+	return array->buffer;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array or @p elem is NULL
+ * @b ERANGE -- @p index is out of range.
+ */
+int sacmp(struct sorted_array* array, size_t index, void* elem)
+{
+	if (array == NULL || elem == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (index >= array->n + array->wbuf_n)
+	{
+		errno = ERANGE;
+		return -1;
+	}
+
+	return array->compar(mergedElem(array, index), elem);
+}
+
+/**
+ * @errors 
+ * @b EINVAL -- @p array is NULL.
+ */
+int sathreads(struct sorted_array* array, size_t threads)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	array->threads = threads > 0 ? threads : 1;
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b ERANGE -- @p index is out of range.
+ */
+int satouch(struct sorted_array* array, size_t index)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (index >= array->n + array->wbuf_n)
+	{
+		errno = ERANGE;
+		return -1;
+	}
+
+	addTouched(array, index, index + 1);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b ERANGE -- @p from is greater than @p to, or @p to is greater than the length of the array.
+ */
+int satouchrange(struct sorted_array* array, size_t from, size_t to)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (from > to || to > array->n + array->wbuf_n)
+	{
+		errno = ERANGE;
+		return -1;
+	}
+
+	addTouched(array, from, to);
+	return 0;
+}
+
+/**
+ * @errors 
+ * @b EINVAL -- @p array is NULL;\n
+ * @b ENOMEM -- Failed to allocate memory for gathering the elements of a blocked array, or to copy the elements of saloadmem().
+ */
+int saresort(struct sorted_array* array)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(array);
+
+	if (ownBuffer(array) != 0)
+		return -1;
+	flushPending(array);
+	// Not invalidateIndex(), touched ranges are still needed here
+	int incremental = array->touched_n > 0 && !array->touched_all;
+	array->index_valid = 0;
+	if (array->tab == NULL)
+	{
+		if (incremental)
+			resortTouched(array, (char*)array->buffer, array->n);
+		else
+			sortElems(array, (char*)array->buffer, array->n);
+		clearTouched(array);
+		return 0;
+	}
+
+	// Blocks keep their sizes, only the elements are redistributed
+	if (ownBlocks(array, 0, array->tab->nblocks) != 0)
+		return -1;
+	struct sa_blocktab* tab = array->tab;
+	size_t size = array->elem_size;
+	char* all = (char*) malloc(array->n * size + 1);
+	if (all == NULL)
+		return -1;
+
+	for (size_t b = 0; b < tab->nblocks; b++)
+		memcpy(all + tab->start[b] * size, tab->blocks[b]->data, tab->blocks[b]->n * size);
+	if (incremental)
+		resortTouched(array, all, array->n);
+	else
+		sortElems(array, all, array->n);
+	clearTouched(array);
+	for (size_t b = 0; b < tab->nblocks; b++)
+	{
+		memcpy(tab->blocks[b]->data, all + tab->start[b] * size, tab->blocks[b]->n * size);
+		updateFence(array, b);
+	}
+
+	free(all);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array or @p func is NULL;\n
+ * @b ENOMEM -- Failed to copy blocks shared with a snapshot, or the elements of saloadmem().
+ */
+int saforeach(struct sorted_array* array, void (*func)(void* elem))
+{
+	if (array == NULL || func == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(array);
+
+	if (ownBuffer(array) != 0)
+		return -1;
+	flushPending(array);
+	if (array->tab != NULL && ownBlocks(array, 0, array->tab->nblocks) != 0)
+		return -1;
+	for (size_t i = 0; i < array->n; i++)
+		func(getElem(array, i));
+	invalidateIndex(array);
+
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p array, @p func or @p context is NULL;\n
+ * @b ENOMEM -- Failed to copy blocks shared with a snapshot, or the elements of saloadmem().
+ */
+int saforeach(struct sorted_array* array, void* context, void (*func)(void* elem, void* context))
+{
+	if (array == NULL || func == NULL || context == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct seq_writer writer(array);
+
+	if (ownBuffer(array) != 0)
+		return -1;
+	flushPending(array);
+	if (array->tab != NULL && ownBlocks(array, 0, array->tab->nblocks) != 0)
+		return -1;
+	for (size_t i = 0; i < array->n; i++)
+		func(getElem(array, i), context);
+	invalidateIndex(array);
+
+	return 0;
+}
+
+
+
+
+// ----------- Unchecked fast paths --------------
+
+void* saget_unchecked(struct sorted_array* array, size_t index)
+{
+	assert(array != NULL && !array->concurrent && index < array->n + array->wbuf_n);
+
+	if (array->tab == NULL && array->wbuf_n == 0)
+		return flatElem(array, index);
+	return mergedElem(array, index);
+}
+
+int sacmp_unchecked(struct sorted_array* array, size_t index, void* elem)
+{
+	return array->compar(saget_unchecked(array, index), elem);
+}
+
+size_t safind_unchecked(struct sorted_array* array, void* elem)
+{
+	assert(array != NULL && elem != NULL);
+
+	if (array->concurrent)
+		return readConsistent<size_t>(array, [=](struct sorted_array* view) { return safind_unchecked(view, elem); });
+
+	ensureIndex(array);
+	size_t place = findPlaceLeft(array, elem);
+	if (array->wbuf_n == 0)
+		return place < array->n && cmp(array, place, elem) == 0 ? place : (size_t)-1;
+
+	size_t pending = findPending(array, elem, 0);
+	if ((place < array->n && cmp(array, place, elem) == 0) || 
+		(pending < array->wbuf_n && array->compar(pendingElem(array, pending), elem) == 0))
+		return place + pending;
+	return (size_t)-1;
+}
+
+
+
+
+// ----------- Iterator --------------
+
+/**
+ * @errors
+ * @b EINVAL -- @p array is NULL;\n
+ * @b ENOMEM -- Failed to allocate memory.
+ */
+struct sa_iter* sainew(struct sorted_array* array)
+{
+	if (array == NULL)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sa_iter* it = (struct sa_iter*) allocWith(&array->allocator, sizeof(struct sa_iter), alignof(struct sa_iter));
+	if (it == NULL)
+		return NULL;
+
+	it -> array = array;
+	it -> i = 0;
+	it -> allocator = array->allocator;
+
+	return it;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p it is NULL.
+ */
+void saidelete(struct sa_iter* it)
+{
+	if (it == NULL)
+	{
+		errno = EINVAL;
+		return;
+	}
+
+	struct sa_allocator allocator = it->allocator;
+	freeWith(&allocator, it, sizeof(struct sa_iter));
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p it is NULL. 
+ */
+int saiend(struct sa_iter* it)
+{
+	if (it == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((it -> i) < (it -> array -> n) + (it -> array -> wbuf_n))
+		return 0;
+	else
+		return 1;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p it is NULL
+ * @b ERANGE -- @p it reached the end and can't go further.
+ */
+int sainext(struct sa_iter* it)
+{
+	if (it == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (it->i >= it->array->n + it->array->wbuf_n)
+	{
+		errno = ERANGE;
+		return -1;
+	}
+
+	it -> i++;
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p it is NULL
+ * @b ERANGE -- @p it reached the end and can't go further.
+ */
+void* saiget(struct sa_iter* it)
+{
+	if (it == NULL)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (it->i >= it->array->n + it->array->wbuf_n)
+	{
+		errno = ERANGE;
+		return NULL;
+	}
+
+	return mergedElem(it -> array, it -> i);
+}
+
+// ----------- Merge iterator --------------
+
+/**
+ * @errors
+ * @b EINVAL -- @p arrays is NULL, one of them is NULL, or their element sizes differ;\n
+ * @b ENOMEM -- Failed to allocate memory.
+ */
+struct sa_merge_iter* samnew(struct sorted_array** arrays, size_t count)
+{
+	if (arrays == NULL && count != 0)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sa_merge_iter* it = (struct sa_merge_iter*) malloc(sizeof(struct sa_merge_iter));
+	if (it == NULL)
+		return NULL;
+
+	if (initMerge(it, arrays, count) != 0)
+	{
+		free(it);
+		return NULL;
+	}
+	return it;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p it is NULL.
+ */
+void samdelete(struct sa_merge_iter* it)
+{
+	if (it == NULL)
+	{
+		errno = EINVAL;
+		return;
+	}
+
+	freeMerge(it);
+	free(it);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p it is NULL.
+ */
+int samend(struct sa_merge_iter* it)
+{
+	if (it == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	return mergeEnd(it);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p it is NULL;\n
+ * @b ERANGE -- @p it reached the end and can't go further.
+ */
+int samnext(struct sa_merge_iter* it)
+{
+	if (it == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (mergeEnd(it))
+	{
+		errno = ERANGE;
+		return -1;
+	}
+
+	replayTree(it);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p it is NULL;\n
+ * @b ERANGE -- @p it reached the end.
+ */
+void* samget(struct sa_merge_iter* it)
+{
+	if (it == NULL)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (mergeEnd(it))
+	{
+		errno = ERANGE;
+		return NULL;
+	}
+
+	return mergeElem(it);
+}
+
+
+// ----------- Sharded array --------------
+
+/**
+ * @errors
+ * @b EINVAL -- @p elem_size is not positive, @p shard_elems is less than 4, or @p compar is NULL;\n
+ * @b ENOMEM -- Failed to allocate memory.
+ */
+struct sa_shards* sashnew(ssize_t elem_size, size_t shard_elems, int (*compar)(const void* a, const void* b))
+{
+	if (elem_size <= 0 || shard_elems < 4 || compar == NULL)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sa_shards* sh = (struct sa_shards*) calloc(1, sizeof(struct sa_shards));
+	if (sh == NULL)
+		return NULL;
+
+	sh->elem_size = elem_size;
+	sh->shard_elems = shard_elems;
+	sh->compar = compar;
+	sh->cap = 4;
+	sh->shards = (struct sa_shard**) malloc(sh->cap * sizeof(struct sa_shard*));
+	sh->bounds = (char*) malloc(sh->cap * elem_size);
+	if (sh->shards == NULL || sh->bounds == NULL || (sh->shards[0] = newShard(sh)) == NULL)
+	{
+		free(sh->shards);
+		free(sh->bounds);
+		free(sh);
+		return NULL;
+	}
+	sh->nshards = 1;
+
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+	// Otherwise a steady stream of insertions starves splits
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	pthread_rwlock_init(&sh->layout, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	return sh;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p sh is NULL.
+ */
+void sashdelete(struct sa_shards* sh)
+{
+	if (sh == NULL)
+	{
+		errno = EINVAL;
+		return;
+	}
+
+	for (size_t i = 0; i < sh->nshards; i++)
+		freeShard(sh->shards[i]);
+	pthread_rwlock_destroy(&sh->layout);
+	free(sh->shards);
+	free(sh->bounds);
+	free(sh);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p sh or @p elem is NULL;\n
+ * @b ENOMEM -- Failed to grow a shard or to split it.
+ */
+int sashput(struct sa_shards* sh, void* elem)
+{
+	if (sh == NULL || elem == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&sh->layout);
+	struct sa_shard* shard = sh->shards[locateShard(sh, elem)];
+	pthread_mutex_lock(&shard->lock);
+	int res = saput(shard->array, elem);
+	size_t n = shard->array->n;
+	__atomic_store_n(&shard->n, n, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&shard->lock);
+	pthread_rwlock_unlock(&sh->layout);
+
+	if (res == 0 && n > sh->shard_elems)
+		res = rebalanceShards(sh, elem);
+	return res;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p sh or @p elem is NULL.
+ */
+int sashrmall(struct sa_shards* sh, void* elem)
+{
+	if (sh == NULL || elem == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&sh->layout);
+	struct sa_shard* shard = sh->shards[locateShard(sh, elem)];
+	pthread_mutex_lock(&shard->lock);
+	size_t before = shard->array->n;
+	sarmall(shard->array, elem);
+	size_t n = shard->array->n;
+	__atomic_store_n(&shard->n, n, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&shard->lock);
+	pthread_rwlock_unlock(&sh->layout);
+
+	if (n < before && n * SA_SHARD_MERGE < sh->shard_elems)
+		return rebalanceShards(sh, elem);
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p sh or @p out is NULL;\n
+ * @b ERANGE -- @p index is out of range.
+ */
+int sashget(struct sa_shards* sh, size_t index, void* out)
+{
+	if (sh == NULL || out == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&sh->layout);
+	size_t s = 0;
+	for (; s < sh->nshards; s++)
+	{
+		size_t n = __atomic_load_n(&sh->shards[s]->n, __ATOMIC_RELAXED);
+		if (index < n)
+			break;
+		index -= n;
+	}
+
+	int res = -1;
+	if (s < sh->nshards)
+	{
+		struct sa_shard* shard = sh->shards[s];
+		pthread_mutex_lock(&shard->lock);
+		res = saread(shard->array, index, index + 1, out);
+		pthread_mutex_unlock(&shard->lock);
+	}
+	else
+		errno = ERANGE;
+	pthread_rwlock_unlock(&sh->layout);
+	return res;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p sh or @p elem is NULL;\n
+ * @b ENOENT -- there is no such element in the array.
+ */
+size_t sashfind(struct sa_shards* sh, void* elem)
+{
+	if (sh == NULL || elem == NULL)
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	pthread_rwlock_rdlock(&sh->layout);
+	size_t s = locateShard(sh, elem);
+	struct sa_shard* shard = sh->shards[s];
+	pthread_mutex_lock(&shard->lock);
+	size_t place = safind(shard->array, elem);
+	pthread_mutex_unlock(&shard->lock);
+	if (place != (size_t)-1)
+		place += shardOffset(sh, s);
+	pthread_rwlock_unlock(&sh->layout);
+	return place;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p sh is NULL.
+ */
+size_t sashlen(struct sa_shards* sh)
+{
+	if (sh == NULL)
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	pthread_rwlock_rdlock(&sh->layout);
+	size_t len = shardOffset(sh, sh->nshards);
+	pthread_rwlock_unlock(&sh->layout);
+	return len;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p sh is NULL.
+ */
+size_t sashcount(struct sa_shards* sh)
+{
+	if (sh == NULL)
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	pthread_rwlock_rdlock(&sh->layout);
+	size_t count = sh->nshards;
+	pthread_rwlock_unlock(&sh->layout);
+	return count;
+}
+
+
+// ----------- Stream writer and reader --------------
+
+/**
+ * @errors
+ * @b EINVAL -- @p out is NULL or @p elem_size is not positive;\n
+ * @b ENOMEM -- Failed to allocate memory;\n
+ * and errors of writing to @p out.
+ */
+struct sa_writer* sawropen(FILE* out, ssize_t elem_size)
+{
+	if (out == NULL || elem_size <= 0)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sa_writer* w = (struct sa_writer*) malloc(sizeof(struct sa_writer));
+	if (w == NULL)
+		return NULL;
+
+	w->out = out;
+	w->elem_size = elem_size;
+	w->n = 0;
+	w->cap = SA_STREAM_CHUNK / elem_size > 0 ? SA_STREAM_CHUNK / elem_size : 1;
+	w->buf = (char*) malloc(w->cap * elem_size);
+	if (w->buf == NULL || writeStreamHeader(out, elem_size, SA_STREAM_UNKNOWN) != 0)
+	{
+		free(w->buf);
+		free(w);
+		return NULL;
+	}
+	return w;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p w is NULL, or @p elems is NULL while @p count is not zero;\n
+ * and errors of writing to the stream.
+ */
+int sawrput(struct sa_writer* w, const void* elems, size_t count)
+{
+	if (w == NULL || (elems == NULL && count != 0))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	const char* p = (const char*) elems;
+	while (count > 0)
+	{
+		size_t take = w->cap - w->n < count ? w->cap - w->n : count;
+		memcpy(w->buf + w->n * w->elem_size, p, take * w->elem_size);
+		w->n += take;
+		p += take * w->elem_size;
+		count -= take;
+
+		if (w->n == w->cap)
+		{
+			if (writeChunk(w->out, w->buf, w->n, w->elem_size) != 0)
+				return -1;
+			w->n = 0;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p w is NULL;\n
+ * and errors of writing to the stream.
+ */
+int sawrclose(struct sa_writer* w)
+{
+	if (w == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	int res = 0;
+	if ((w->n > 0 && writeChunk(w->out, w->buf, w->n, w->elem_size) != 0) ||
+		writeChunk(w->out, NULL, 0, w->elem_size) != 0 || fflush(w->out) != 0)
+		res = -1;
+
+	free(w->buf);
+	free(w);
+	return res;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p in is NULL, @p elem_size is not positive or the stream stores elements of another size;\n
+ * @b EPROTO -- The stream is not a sorted array of this format version;\n
+ * @b EBADMSG -- The stream is truncated;\n
+ * @b ENOMEM -- Failed to allocate memory;\n
+ * and errors of reading from @p in.
+ */
+struct sa_reader* sardopen(FILE* in, ssize_t elem_size)
+{
+	if (in == NULL || elem_size <= 0)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sa_stream_header header;
+	if (readAll(in, &header, sizeof(header)) != 0 || checkStreamHeader(&header) != 0)
+		return NULL;
+	if (header.elem_size != (uint64_t)elem_size)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sa_reader* r = (struct sa_reader*) malloc(sizeof(struct sa_reader));
+	if (r == NULL)
+		return NULL;
+	*r = (struct sa_reader) { in, (size_t)elem_size, 0, 0, 0, 0 };
+	return r;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p r is NULL, or @p out is NULL while @p max is not zero;\n
+ * @b EBADMSG -- The stream is truncated or corrupted;\n
+ * and errors of reading from the stream.
+ */
+size_t sardnext(struct sa_reader* r, void* out, size_t max)
+{
+	if (r == NULL || (out == NULL && max != 0))
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	return readElems(r, out, max);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p r is NULL.
+ */
+void sardclose(struct sa_reader* r)
+{
+	if (r == NULL)
+	{
+		errno = EINVAL;
+		return;
+	}
+
+	free(r);
+}
+
+
+// ----------- External memory --------------
+
+/**
+ * @errors
+ * @b EINVAL -- @p path or @p compar is NULL, @p elem_size is not positive or @p mem_elems is less than 2;\n
+ * @b ENOMEM -- Failed to allocate memory;\n
+ * and errors of fopen().
+ */
+struct sa_xbuilder* saxnew(const char* path, ssize_t elem_size, size_t mem_elems, 
+	int (*compar)(const void* a, const void* b))
+{
+	if (path == NULL || compar == NULL || elem_size <= 0 || mem_elems < 2)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct sa_xbuilder* b = (struct sa_xbuilder*) calloc(1, sizeof(struct sa_xbuilder));
+	if (b == NULL)
+		return NULL;
+
+	b->path = strdup(path);
+	b->run = sanew(elem_size, mem_elems, compar);
+	if (b->path == NULL || b->run == NULL || (b->out = fopen(path, "wb")) == NULL)
+	{
+		if (b->run != NULL)
+			sadelete(b->run);
+		free(b->path);
+		free(b);
+		return NULL;
+	}
+	return b;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p b or @p elem is NULL;\n
+ * and errors of writing a run.
+ */
+int saxput(struct sa_xbuilder* b, void* elem)
+{
+	return saxputn(b, elem, 1);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p b is NULL, or @p elems is NULL while @p count is not zero;\n
+ * and errors of writing a run.
+ */
+int saxputn(struct sa_xbuilder* b, void* elems, size_t count)
+{
+	if (b == NULL || (elems == NULL && count != 0))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct sorted_array* run = b->run;
+	const char* p = (const char*) elems;
+	while (count > 0)
 	{
-		center = (left + right) / 2;
-		int sign = cmp(array, center, elem);
-		if (sign <= 0)
-			left = center;
-		else
-			right = center;
+		if (run->n == run->max_elems && flushRun(b) != 0)
+			return -1;
+
+		size_t take = run->max_elems - run->n < count ? run->max_elems - run->n : count;
+		memcpy(flatElem(run, run->n), p, take * run->elem_size);
+		run->n += take;
+		b->n += take;
+		p += take * run->elem_size;
+		count -= take;
 	}
-	return right;
+	return 0;
 }
 
+/**
+ * @errors
+ * @b EINVAL -- @p b is NULL;\n
+ * @b ENOMEM -- Failed to allocate memory;\n
+ * and errors of reading and writing the runs and the output file.
+ */
+int saxfinish(struct sa_xbuilder* b)
+{
+	if (b == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
 
+	size_t size = b->run->elem_size;
+	size_t mem_elems = b->run->max_elems;
+	int res = writeFileHeader(b->out, size, b->n);
 
+	if (res == 0 && b->nruns == 0)
+	{
+		// Everything fits in memory, so there's nothing to merge
+		sortElems(b->run, (char*)b->run->buffer, b->run->n);
+		res = writeAll(b->out, b->run->buffer, b->run->n * size);
+	}
+	else if (res == 0)
+	{
+		if (b->run->n > 0)
+			res = flushRun(b);
+		freeBuffer(b->run);
+		b->run->buffer = NULL;
+		b->run->buf_bytes = 0;
+		b->run->buf_mapped = 0;
+		b->run->max_elems = 0;
 
+		// The memory of the run is split between the windows of the runs merged at once
+		size_t ways = b->nruns < SA_XMERGE_WAYS ? b->nruns : SA_XMERGE_WAYS;
+		size_t window = mem_elems / (ways + 1) > 2 ? mem_elems / (ways + 1) : 2;
+		if (res == 0)
+			res = mergePasses(b, window);
+		if (res == 0)
+			res = mergeExternal(b->runs, b->nruns, size, window, b->run->compar, NULL, b->out);
+	}
 
+	if (fclose(b->out) != 0)
+		res = -1;
+	closeRuns(b->runs, b->nruns);
+	free(b->runs);
+	sadelete(b->run);
+	free(b->path);
+	free(b);
+	return res;
+}
 
-// =================================  API funcs  =======================================
 /**
  * @errors
+ * @b EINVAL -- @p path or @p compar is NULL, @p elem_size is not positive or the file stores elements of another size;\n
+ * @b EPROTO -- The file is not a sorted array of this format version;\n
+ * @b EBADMSG -- The file is truncated;\n
  * @b ENOMEM -- Failed to allocate memory;\n
- * @b ERANGE -- @p elem_size is not positive or @p max_elems is negative.
+ * and errors of open().
  */
-struct sorted_array* sanew(ssize_t elem_size, ssize_t max_elems, int (*compar)(const void* a, const void* b))
+struct sa_xarray* saxopen(const char* path, ssize_t elem_size, size_t block_elems, 
+	int (*compar)(const void* a, const void* b))
 {
-	if (elem_size <= 0 || max_elems < 0)
+	if (path == NULL || compar == NULL || elem_size <= 0)
 	{
-		errno = ERANGE;
+		errno = EINVAL;
 		return NULL;
 	}
 
-	struct sorted_array* array = (struct sorted_array*) malloc(sizeof(struct sorted_array));
-	if (array == NULL)
+	struct sa_xarray* x = (struct sa_xarray*) calloc(1, sizeof(struct sa_xarray));
+	if (x == NULL)
+		return NULL;
+	x->fd = open(path, O_RDONLY);
+	if (x->fd < 0)
+	{
+		free(x);
 		return NULL;
+	}
 
-	array->buffer = malloc(elem_size * max_elems);
-	if (array->buffer == NULL)
+	struct stat st;
+	struct sa_file_header header;
+	memset(&header, 0, sizeof(header));
+	if (fstat(x->fd, &st) != 0 || 
+		((size_t)st.st_size >= sizeof(header) && preadAll(x->fd, &header, sizeof(header), 0) != 0) ||
+		checkHeader((const char*)&header, st.st_size, elem_size) != 0)
 	{
-		free(array);
+		freeXarray(x);
 		return NULL;
 	}
 
-	array->max_elems = max_elems;
-	array->elem_size = elem_size;
-	array->compar = compar;
+	x->elem_size = elem_size;
+	x->n = header.n;
+	x->block_elems = block_elems ? block_elems : (SA_XBLOCK_BYTES / elem_size ? SA_XBLOCK_BYTES / elem_size : 1);
+	x->cached = (size_t)-1;
 
-	array->n = 0;
+	size_t blocks = (x->n + x->block_elems - 1) / x->block_elems;
+	x->fences = sanew(elem_size, blocks, compar);
+	x->block = sanew(elem_size, x->block_elems, compar);
+	if (x->fences == NULL || x->block == NULL)
+	{
+		freeXarray(x);
+		return NULL;
+	}
 
-	return array;
+	for (size_t b = 0; b < blocks; b++)
+	{
+		if (preadAll(x->fd, flatElem(x->fences, b), elem_size, xoffset(x, b * x->block_elems)) != 0)
+		{
+			freeXarray(x);
+			return NULL;
+		}
+	}
+	x->fences->n = blocks;
+	return x;
 }
 
 /**
  * @errors
- * @b EINVAL -- @p array is NULL.
+ * @b EINVAL -- @p x is NULL.
  */
-void sadelete(struct sorted_array* array)
+void saxclose(struct sa_xarray* x)
 {
-	if (array == NULL)
+	if (x == NULL)
 	{
 		errno = EINVAL;
 		return;
 	}
 
-	free(array->buffer);
-	free(array);
+	freeXarray(x);
 }
 
 /**
  * @errors
- * @b EINVAL -- @p array is NULL;\n
- * @b ERANGE -- @p index is out of range.
+ * @b EINVAL -- @p x is NULL.
  */
-void* saget(struct sorted_array* array, size_t index)
+size_t saxlen(struct sa_xarray* x)
 {
-	if (array == NULL)
+	if (x == NULL)
 	{
 		errno = EINVAL;
-		return NULL;
-	}
-
-	if (index >= array->n)
-	{
-		errno = ERANGE;
-		return NULL;
+		return (size_t)-1;
 	}
 
-	return (char*)array->buffer + index * array->elem_size;
+	return x->n;
 }
 
 /**
  * @errors
- * @b EINVAL -- @p array is NULL;\n
- * @b ENOBUFS -- Maximum number of stored elements is reached.
+ * @b EINVAL -- @p x or @p out is NULL;\n
+ * @b ERANGE -- @p index is out of bounds;\n
+ * and errors of reading the file.
  */
-int saput(struct sorted_array* array, void* elem)
+int saxget(struct sa_xarray* x, size_t index, void* out)
 {
-	if (array == NULL || elem == NULL)
+	if (x == NULL || out == NULL)
 	{
 		errno = EINVAL;
 		return -1;
 	}
-	
-	if (array->n >= array->max_elems)
+
+	if (index >= x->n)
 	{
-		errno = ENOBUFS;
+		errno = ERANGE;
 		return -1;
 	}
 
-	size_t place = findPlaceRight(array, elem);
-	shiftRight(array, place, array->elem_size);
-	memcpy(getElem(array, place), elem, array->elem_size);
-	array->n++;
-
+	size_t b = index / x->block_elems;
+	if (loadBlock(x, b) != 0)
+		return -1;
+	memcpy(out, flatElem(x->block, index - b * x->block_elems), x->elem_size);
 	return 0;
 }
 
 /**
  * @errors
- * @b EINVAL -- @p array is NULL;\n
- * @b ERANGE -- @p index is out of range.
+ * @b EINVAL -- @p x is NULL, or @p out is NULL while the range is not empty;\n
+ * @b ERANGE -- @p from is greater than @p to, or @p to is greater than the length of the array;\n
+ * and errors of reading the file.
  */
-int sarm(struct sorted_array* array, size_t index)
+int saxread(struct sa_xarray* x, size_t from, size_t to, void* out)
 {
-	if (array == NULL)
+	if (x == NULL || (out == NULL && from != to))
 	{
 		errno = EINVAL;
 		return -1;
 	}
 
-	if (index >= array->n)
+	if (from > to || to > x->n)
 	{
 		errno = ERANGE;
 		return -1;
 	}
 
-	shifLeft(array, index, array->elem_size);
-	array->n--;
-	return 0;
+	return preadAll(x->fd, out, (to - from) * x->elem_size, xoffset(x, from));
 }
 
 /**
  * @errors
- * @b EINVAL -- @p array or @p elem is NULL
+ * @b EINVAL -- @p x or @p elem is NULL;\n
+ * @b ENOENT -- there is no such element in the array;\n
+ * and errors of reading the file.
  */
-int sarmall(struct sorted_array* array, void* elem)
+size_t saxfind(struct sa_xarray* x, void* elem)
 {
-	if (array == NULL || elem == NULL)
+	if (x == NULL || elem == NULL)
 	{
 		errno = EINVAL;
-		return -1;
+		return (size_t)-1;
 	}
 
-	size_t left = findPlaceLeft(array, elem);
-	size_t right = findPlaceRight(array, elem);
-
-	shifLeft(array, left, (right - left) * array->elem_size);
-	array->n -= right - left;
+	size_t place = xsearch(x, elem, 0);
+	if (place == (size_t)-1)
+		return (size_t)-1;
 
-	return 0;
+	size_t b = place / x->block_elems;
+	if (place < x->n && loadBlock(x, b) != 0)
+		return (size_t)-1;
+	if (place == x->n || cmp(x->block, place - b * x->block_elems, elem) != 0)
+	{
+		errno = ENOENT;
+		return (size_t)-1;
+	}
+	return place;
 }
 
 /**
  * @errors
- * @b EINVAL -- @p array is NULL.
+ * @b EINVAL -- @p x or @p elem is NULL;\n
+ * and errors of reading the file.
  */
-size_t salen(struct sorted_array* array)
+size_t saxlower(struct sa_xarray* x, void* elem)
 {
-	if (array == NULL)
+	if (x == NULL || elem == NULL)
 	{
 		errno = EINVAL;
-		return (size_t) -1;
+		return (size_t)-1;
 	}
 
-	return array -> n;
+	return xsearch(x, elem, 0);
 }
 
 /**
  * @errors
- * @b EINVAL -- @p array or @p elem is NULL;\n
- * @b ENOENT -- there is no such element in the array.
+ * @b EINVAL -- @p x or @p elem is NULL;\n
+ * and errors of reading the file.
  */
-size_t safind(struct sorted_array* array, void* elem)
+size_t saxupper(struct sa_xarray* x, void* elem)
 {
-	if (array == NULL || elem == NULL)
+	if (x == NULL || elem == NULL)
 	{
 		errno = EINVAL;
 		return (size_t)-1;
 	}
 
-	if (array->n == 0)
+	return xsearch(x, elem, 1);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p x, @p lo, @p hi, @p begin or @p end is NULL;\n
+ * and errors of reading the file.
+ */
+int saxrange(struct sa_xarray* x, void* lo, void* hi, size_t* begin, size_t* end)
+{
+	if (x == NULL || lo == NULL || hi == NULL || begin == NULL || end == NULL)
 	{
-		errno = ENOENT;
-		return (size_t)-1;
+		errno = EINVAL;
+		return -1;
 	}
 
-	size_t place = findPlaceLeft(array, elem);
-	if (place == array->n)
+	*begin = xsearch(x, lo, 0);
+	*end = xsearch(x, hi, 1);
+	if (*begin == (size_t)-1 || *end == (size_t)-1)
+		return -1;
+	if (*end < *begin)
+		*end = *begin;
+	return 0;
+}
+
+
+// ----------- Sorted map --------------
+
+/**
+ * @errors
+ * @b ENOMEM -- Failed to allocate memory;\n
+ * @b ERANGE -- @p key_size is not positive, or @p value_size or @p max_elems is negative.
+ */
+struct sorted_map* smnew(ssize_t key_size, ssize_t value_size, ssize_t max_elems, 
+	int (*compar)(const void* a, const void* b))
+{
+	if (value_size < 0)
 	{
-		errno = ENOENT;
-		return (size_t)-1;
+		errno = ERANGE;
+		return NULL;
 	}
 
-	if (cmp(array, place, elem) == 0)
-		return place;
-	else
+	struct sorted_map* map = (struct sorted_map*) malloc(sizeof(struct sorted_map));
+	if (map == NULL)
+		return NULL;
+
+	map->keys = sanew(key_size, max_elems, compar);
+	map->values = NULL;
+	map->value_size = value_size;
+	map->values_cap = 0;
+	if (map->keys == NULL || syncValues(map) != 0)
 	{
-		errno = ENOENT;
-		return (size_t)-1;
+		if (map->keys != NULL)
+			sadelete(map->keys);
+		free(map->values);
+		free(map);
+		return NULL;
 	}
+	return map;
 }
 
 /**
  * @errors
- * @b EINVAL -- @p array or @p elem is NULL
- * @b ERANGE -- @p index is out of range.
+ * @b EINVAL -- @p map is NULL.
  */
-int sacmp(struct sorted_array* array, size_t index, void* elem)
+void smdelete(struct sorted_map* map)
 {
-	if (array == NULL || elem == NULL)
+	if (map == NULL)
 	{
 		errno = EINVAL;
-		return -1;
+		return;
 	}
 
-	if (index >= array->n)
+	sadelete(map->keys);
+	free(map->values);
+	free(map);
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p map is NULL.
+ */
+int smgrowable(struct sorted_map* map, int growable)
+{
+	if (map == NULL)
 	{
-		errno = ERANGE;
+		errno = EINVAL;
 		return -1;
 	}
 
-	return cmp(array, index, elem);
+	return sagrowable(map->keys, growable);
 }
 
 /**
- * @errors 
- * @b EINVAL -- @p array is NULL.
+ * @errors
+ * @b EINVAL -- @p map is NULL, or @p type doesn't match the key size.
  */
-int saresort(struct sorted_array* array)
+int smkeytype(struct sorted_map* map, enum sa_key_type type)
 {
-	if (array == NULL)
+	if (map == NULL)
 	{
 		errno = EINVAL;
 		return -1;
 	}
 
-	qsort(array->buffer, array->n, array->elem_size, array->compar);
-	return 0;
+	return sakeytype(map->keys, type);
 }
 
-/// @errors @b EINVAL -- @p array or @p func is NULL;
-int saforeach(struct sorted_array* array, void (*func)(void* elem))
+/**
+ * @errors
+ * @b EINVAL -- @p map, @p key or @p value is NULL;\n
+ * @b ENOBUFS -- Maximum number of stored elements is reached;\n
+ * @b ENOMEM -- Failed to grow a growable map.
+ */
+int smput(struct sorted_map* map, const void* key, const void* value)
 {
-	if (array == NULL || func == NULL)
+	if (map == NULL || key == NULL || (value == NULL && map->value_size != 0))
 	{
 		errno = EINVAL;
 		return -1;
 	}
 
-	for (size_t i = 0; i < array->n; i++)
-		func(getElem(array, i));
+	struct sorted_array* keys = map->keys;
+	size_t place = findPlaceLeft(keys, (void*)key);
+	if (place < keys->n && cmp(keys, place, (void*)key) == 0)
+	{
+		memcpy(mapValue(map, place), value, map->value_size);
+		return 0;
+	}
+
+	if (ensureSpace(keys, 1) != 0 || syncValues(map) != 0)
+		return -1;
 
+	shiftRight(keys, place, keys->elem_size);
+	memcpy(flatElem(keys, place), key, keys->elem_size);
+	memmove(mapValue(map, place + 1), mapValue(map, place), (keys->n - place) * map->value_size);
+	memcpy(mapValue(map, place), value, map->value_size);
+	keys->n++;
+	invalidateIndex(keys);
 	return 0;
 }
 
-/// @errors @b EINVAL -- @p array, @p func or @p context is NULL;
-int saforeach(struct sorted_array* array, void* context, void (*func)(void* elem, void* context))
+/**
+ * @errors
+ * @b EINVAL -- @p map or @p key is NULL;\n
+ * @b ENOENT -- there is no such key in the map.
+ */
+int smrm(struct sorted_map* map, const void* key)
 {
-	if (array == NULL || func == NULL || context == NULL)
+	if (map == NULL || key == NULL)
 	{
 		errno = EINVAL;
 		return -1;
 	}
 
-	for (size_t i = 0; i < array->n; i++)
-		func(getElem(array, i), context);
+	struct sorted_array* keys = map->keys;
+	size_t index = mapLocate(map, key);
+	if (index == (size_t)-1)
+	{
+		errno = ENOENT;
+		return -1;
+	}
 
+	shifLeft(keys, index, keys->elem_size);
+	memmove(mapValue(map, index), mapValue(map, index + 1), (keys->n - index - 1) * map->value_size);
+	keys->n--;
+	invalidateIndex(keys);
 	return 0;
 }
 
-
-
-
-// ----------- Iterator --------------
-
 /**
  * @errors
- * @b EINVAL -- @p array is NULL;\n
- * @b ENOMEM -- Failed to allocate memory.
+ * @b EINVAL -- @p map or @p key is NULL;\n
+ * @b ENOENT -- there is no such key in the map.
  */
-struct sa_iter* sainew(struct sorted_array* array)
+void* smfind(struct sorted_map* map, const void* key)
 {
-	if (array == NULL)
+	if (map == NULL || key == NULL)
 	{
 		errno = EINVAL;
 		return NULL;
 	}
 
-	struct sa_iter* it = (struct sa_iter*) malloc(sizeof(struct sa_iter));
-	if (it == NULL)
+	size_t index = mapLocate(map, key);
+	if (index == (size_t)-1)
+	{
+		errno = ENOENT;
 		return NULL;
+	}
+	return mapValue(map, index);
+}
 
-	it -> array = array;
-	it -> i = 0;
+/**
+ * @errors
+ * @b EINVAL -- @p map or @p key is NULL.
+ */
+size_t smlower(struct sorted_map* map, const void* key)
+{
+	if (map == NULL || key == NULL)
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
 
-	return it;
+	return findPlaceLeft(map->keys, (void*)key);
 }
 
 /**
  * @errors
- * @b EINVAL -- @p it is NULL.
+ * @b EINVAL -- @p map is NULL.
  */
-void saidelete(struct sa_iter* it)
+size_t smlen(struct sorted_map* map)
 {
-	if (it == NULL)
+	if (map == NULL)
 	{
 		errno = EINVAL;
-		return;
+		return (size_t)-1;
 	}
 
-	free(it);
+	return map->keys->n;
 }
 
 /**
  * @errors
- * @b EINVAL -- @p it is NULL. 
+ * @b EINVAL -- @p map is NULL;\n
+ * @b ERANGE -- @p index is out of bounds.
  */
-int saiend(struct sa_iter* it)
+void* smkey(struct sorted_map* map, size_t index)
 {
-	if (it == NULL)
+	if (map == NULL)
 	{
 		errno = EINVAL;
-		return -1;
+		return NULL;
 	}
 
-	if ((it -> i) < (it -> array -> n))
-		return 0;
-	else
-		return 1;
+	if (index >= map->keys->n)
+	{
+		errno = ERANGE;
+		return NULL;
+	}
+	return flatElem(map->keys, index);
 }
 
 /**
  * @errors
- * @b EINVAL -- @p it is NULL
- * @b ERANGE -- @p it reached the end and can't go further.
+ * @b EINVAL -- @p map is NULL;\n
+ * @b ERANGE -- @p index is out of bounds.
  */
-int sainext(struct sa_iter* it)
+void* smvalue(struct sorted_map* map, size_t index)
 {
-	if (it == NULL)
+	if (map == NULL)
 	{
 		errno = EINVAL;
-		return -1;
+		return NULL;
 	}
 
-	if (it->i >= it->array->n)
+	if (index >= map->keys->n)
 	{
 		errno = ERANGE;
-		return -1;
+		return NULL;
 	}
-
-	it -> i++;
-	return 0;
+	return mapValue(map, index);
 }
 
 /**
  * @errors
- * @b EINVAL -- @p it is NULL
- * @b ERANGE -- @p it reached the end and can't go further.
+ * @b EINVAL -- @p map is NULL.
  */
-void* saiget(struct sa_iter* it)
+void* smkeys(struct sorted_map* map)
 {
-	if (it == NULL)
+	if (map == NULL)
 	{
 		errno = EINVAL;
 		return NULL;
 	}
 
-	if (it->i >= it->array->n)
+	return map->keys->buffer;
+}
+
+/**
+ * @errors
+ * @b EINVAL -- @p map is NULL.
+ */
+void* smvalues(struct sorted_map* map)
+{
+	if (map == NULL)
 	{
-		errno = ERANGE;
+		errno = EINVAL;
 		return NULL;
 	}
 
-	return getElem(it -> array, it -> i);
+	return map->values;
 }
@@ -5,16 +5,60 @@
  * - struct sotred_array;
  * - functions for creating and destroying a sorted array:
  *   + sanew();
+ *   + sanew_ex();
  *   + sadelete();
+ * - functions for arrays stored in files:
+ *   + saopen();
+ *   + sasync();
+ * - functions for saving arrays in a compact binary format:
+ *   + sasave();
+ *   + saload();
+ *   + saloadmem();
+ * - streaming writer and reader of this format:
+ *   + struct sa_writer;
+ *   + sawropen();
+ *   + sawrput();
+ *   + sawrclose();
+ *   + struct sa_reader;
+ *   + sardopen();
+ *   + sardnext();
+ *   + sardclose();
+ * - functions for managing capacity:
+ *   + sagrowable();
+ *   + sareserve();
+ *   + sashrink();
  * - functions for working with elements:
  *   + saput();
+ *   + saputn();
  *   + saget();
+ *   + saread();
  *   + sarm();
  *   + sarmall();
+ *   + sarmif();
+ *   + sarmrange();
  * - functions for obtaining information about an array and its elements:
  *   + salen();
  *   + safind();
+ *   + safindn();
  *   + sacmp();
+ * - unchecked variants of these functions for hot loops:
+ *   + saget_unchecked();
+ *   + sacmp_unchecked();
+ *   + safind_unchecked();
+ * - range query functions:
+ *   + salower();
+ *   + saupper();
+ *   + sarange();
+ *   + sacount();
+ *   + sadata();
+ * - saindex() function to speed up searches in read-mostly arrays;
+ * - sakeytype() function to search arrays of primitive keys with SIMD instructions;
+ * - sablocks() function to switch an array to the blocked layout with cheap insertions and removals;
+ * - sasnapshot() function to take copy-on-write snapshots of blocked arrays;
+ * - functions for buffering insertions in ingest-heavy workloads:
+ *   + sawbuffer();
+ *   + saflush();
+ * - saconcurrent() function to read an array from many threads without locks while one thread writes it;
  * - iterator interface for this structure:
  *   + struct sa_iter;
  *   + sainew();
@@ -22,13 +66,70 @@
  *   + saiend();
  *   + sainext();
  *   + saiget();
+ * - merge iterator over many sorted arrays:
+ *   + struct sa_merge_iter;
+ *   + samnew();
+ *   + samdelete();
+ *   + samend();
+ *   + samnext();
+ *   + samget();
+ *   + samerge();
+ * - sharded array for inserting from many threads:
+ *   + struct sa_shards;
+ *   + sashnew();
+ *   + sashdelete();
+ *   + sashput();
+ *   + sashrmall();
+ *   + sashget();
+ *   + sashfind();
+ *   + sashlen();
+ *   + sashcount();
+ * - external-memory arrays for data larger than RAM:
+ *   + struct sa_xbuilder;
+ *   + saxnew();
+ *   + saxput();
+ *   + saxputn();
+ *   + saxfinish();
+ *   + struct sa_xarray;
+ *   + saxopen();
+ *   + saxclose();
+ *   + saxlen();
+ *   + saxget();
+ *   + saxread();
+ *   + saxfind();
+ *   + saxlower();
+ *   + saxupper();
+ *   + saxrange();
+ * - sorted map with keys and values in separate buffers:
+ *   + struct sorted_map;
+ *   + smnew();
+ *   + smdelete();
+ *   + smgrowable();
+ *   + smkeytype();
+ *   + smput();
+ *   + smrm();
+ *   + smfind();
+ *   + smlower();
+ *   + smlen();
+ *   + smkey();
+ *   + smvalue();
+ *   + smkeys();
+ *   + smvalues();
  * - different variants of saforeach() function.
- * - saresort() function to fix broken order in case when it can change.
+ * - linear-time set algebra between sorted arrays:
+ *   + saunion();
+ *   + saintersect();
+ *   + sadiff();
+ *   + sasymdiff();
+ *   + saintersectcount();
+ * - saresort() function to fix broken order in case when it can change, and sathreads() to make it parallel.
+ * - satouch() and satouchrange() functions to mark changed elements, so that saresort() sorts only them.
  */
 
 #ifndef SORTED_ARRAY_H
 #define SORTED_ARRAY_H
 
+#include <stdio.h>
 #include <stdlib.h>
 
 /** @struct sorted_array
@@ -65,6 +166,43 @@
  */
 struct sorted_array* sanew(ssize_t elem_size, ssize_t max_elems, int (*compar)(const void* a, const void* b));
 
+/**
+ * Memory allocator for sanew_ex().
+ *
+ * @p ctx is passed to every call. @p bytes passed to @p realloc and @p free are the sizes the memory was asked with.
+ */
+struct sa_allocator
+{
+	void* (*alloc)(void* ctx, size_t bytes, size_t align);	///< Allocate @p bytes aligned to @p align, a power of two
+	void* (*realloc)(void* ctx, void* p, size_t old_bytes, size_t bytes);	///< Optional; never used for SA_ALLOC_ALIGNED arrays
+	void (*free)(void* ctx, void* p, size_t bytes);
+	void* ctx;
+};
+
+/// Flags of sanew_ex().
+enum sa_alloc_flags
+{
+	SA_ALLOC_ALIGNED = 1,	///< Align the buffer to a cache line
+	SA_ALLOC_HUGEPAGES = 2,	///< Ask for transparent huge pages under large buffers with madvise(MADV_HUGEPAGE)
+	SA_ALLOC_HUGETLB = 4	///< Map large buffers with MAP_HUGETLB, or with transparent huge pages, if none are reserved
+};
+
+/**
+ * Create a new sorted array with a custom allocator and buffer options.
+ *
+ * With an @p allocator, the sorted_array struct, the buffer and iterators (see sainew()) are allocated with it, 
+ * and the buffer is never mapped, whatever its size. Other internal memory, like blocks and indices, comes from malloc().
+ * Without it, buffers of 1 MiB and more are mapped directly, and huge page flags apply to them; 
+ * their sizes are then rounded up to 2 MiB.
+ *
+ * @param allocator allocator to use, or NULL for malloc(); it is copied
+ * @param flags a combination of ::sa_alloc_flags; huge page flags can't be used with an @p allocator
+ * @return A pointer to newly created array, or NULL in case of an error.
+ * @see sanew()
+ */
+struct sorted_array* sanew_ex(ssize_t elem_size, ssize_t max_elems, int (*compar)(const void* a, const void* b), 
+	const struct sa_allocator* allocator, int flags);
+
 /**
  * Delete a sorted array.
  *
@@ -72,6 +210,154 @@ struct sorted_array* sanew(ssize_t elem_size, ssize_t max_elems, int (*compar)(c
  */
 void sadelete(struct sorted_array* array);
 
+/// Flags of saopen().
+enum sa_open_flags
+{
+	SA_OPEN_READ = 0,	///< Open an existing file read-only
+	SA_OPEN_WRITE = 1,	///< Open an existing file for reading and writing
+	SA_OPEN_CREATE = 2	///< Create the file, if it doesn't exist; requires SA_OPEN_WRITE
+};
+
+/**
+ * Open a sorted array stored in a file, mapping the file into memory.
+ *
+ * Opening costs O(1) whatever the size of the array: nothing is read until the pages are touched.
+ * The file starts with a header holding a format version, the element size and the number of elements,
+ * which are checked on opening, and the elements follow it in their order.
+ * The file is in the byte order of the machine and is only portable between machines with the same one.
+ *
+ * A writable array is mapped shared, so changes go to the file. The capacity of the array is the size of the file,
+ * and growing the array grows the file. The number of elements is stored in the header by sasync() and sadelete().
+ *
+ * A read-only array is mapped privately, so any number of processes opening the same file share its page cache.
+ * It can still be changed, but changes are never written to the file, and growing it copies it to memory.
+ *
+ * Switching an opened array to the blocked layout closes the file.
+ * @param max_elems capacity of a newly created file; ignored when the file exists.
+ * @param flags a combination of ::sa_open_flags.
+ * @return A pointer to the opened array, or NULL in case of an error.
+ */
+struct sorted_array* saopen(const char* path, ssize_t elem_size, ssize_t max_elems, 
+	int (*compar)(const void* a, const void* b), int flags);
+
+/**
+ * Write all changes of a writable file-backed array to its file and wait until they are stored.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int sasync(struct sorted_array* array);
+
+/**
+ * Save a sorted array to a stream in a compact binary format.
+ *
+ * The stream starts with a header holding a format version, the element size and the number of elements,
+ * and the elements follow it in chunks, each of them with its own checksum. Blocked arrays are saved block by block.
+ * The format is in the byte order of the machine, like files of saopen().
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int sasave(struct sorted_array* array, FILE* out);
+
+/**
+ * Load a sorted array saved by sasave() or written by a ::sa_writer.
+ *
+ * Elements are read right into the buffer of the new array, and sorted only if they are out of order.
+ * @param compar comparator function, the same as for sanew()
+ * @return A pointer to the loaded array, or NULL in case of an error.
+ */
+struct sorted_array* saload(FILE* in, int (*compar)(const void* a, const void* b));
+
+/**
+ * Load a sorted array from @p bytes bytes of memory at @p data, holding a stream saved by sasave().
+ *
+ * When the stream has one chunk of sorted elements, the array uses them in place without copying,
+ * so @p data must stay valid and must not be changed by anyone else until the array is deleted.
+ * The array never writes to @p data: it copies the elements, as soon as they are changed, removed, resorted or have to grow.
+ * Pointers returned by saget() and sadata() point into @p data until then, so they must not be written through.
+ * Otherwise the elements are copied to a buffer of the array.
+ *
+ * @return A pointer to the loaded array, or NULL in case of an error.
+ */
+struct sorted_array* saloadmem(void* data, size_t bytes, int (*compar)(const void* a, const void* b));
+
+/** @struct sa_writer
+ * Writer of the sasave() format, that takes elements in order piece by piece,
+ * so an array can be exported without holding all of it in memory.
+ * The number of elements in the header is left unknown, and the stream ends with an empty chunk.
+ */
+struct sa_writer;
+
+/**
+ * Start writing a stream of elements of size @p elem_size to @p out.
+ *
+ * @return A pointer to the new writer, or NULL in case of an error.
+ */
+struct sa_writer* sawropen(FILE* out, ssize_t elem_size);
+
+/**
+ * Write @p count elements from @p elems. The elements must follow the ones written before in their order.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int sawrput(struct sa_writer* w, const void* elems, size_t count);
+
+/**
+ * Write the rest of the elements and the end of the stream, and delete the writer.
+ * The stream itself is not closed.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int sawrclose(struct sa_writer* w);
+
+/** @struct sa_reader
+ * Reader of the sasave() format, that returns elements piece by piece, checking the chunks as they are read.
+ */
+struct sa_reader;
+
+/**
+ * Start reading a stream of elements of size @p elem_size from @p in.
+ *
+ * @return A pointer to the new reader, or NULL in case of an error.
+ */
+struct sa_reader* sardopen(FILE* in, ssize_t elem_size);
+
+/**
+ * Read up to @p max elements to @p out.
+ *
+ * @return The number of elements read, 0 at the end of the stream, or (size_t)-1 in case of an error.
+ */
+size_t sardnext(struct sa_reader* r, void* out, size_t max);
+
+/**
+ * Delete a reader. The stream itself is not closed.
+ */
+void sardclose(struct sa_reader* r);
+
+/**
+ * Turn growable mode of a sorted array on or off.
+ *
+ * A growable array doesn't fail with ENOBUFS when it is full, but at least doubles its capacity instead,
+ * so the cost of growing is amortized over insertions.
+ * Large buffers are mapped directly and grown with mremap(), so growing never copies the stored elements.
+ * @return 0 on success, -1 in case of an error.
+ */
+int sagrowable(struct sorted_array* array, int growable);
+
+/**
+ * Make the capacity of a sorted array at least @p count elements.
+ *
+ * Works for both growable and fixed arrays. Does nothing if the capacity is already big enough.
+ * @return 0 on success, -1 in case of an error.
+ */
+int sareserve(struct sorted_array* array, size_t count);
+
+/**
+ * Shrink the capacity of a sorted array to the number of currently stored elements, releasing unused memory.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int sashrink(struct sorted_array* array);
+
 /**
  * Get a pointer to an element of the array by its index.
  *
@@ -80,6 +366,14 @@ void sadelete(struct sorted_array* array);
  */
 void* saget(struct sorted_array* array, size_t index);
 
+/**
+ * Copy elements with indices in [@p from, @p to) of a sorted array to @p out.
+ *
+ * Unlike dereferencing saget(), the copy is consistent when a concurrent array (see saconcurrent()) is changed meanwhile.
+ * @return 0 on success, -1 in case of an error.
+ */
+int saread(struct sorted_array* array, size_t from, size_t to, void* out);
+
 /**
  * Put an element into a sorted array.
  *
@@ -88,6 +382,16 @@ void* saget(struct sorted_array* array, size_t index);
  */
 int saput(struct sorted_array* array, void* elem);
 
+/**
+ * Put a batch of elements into a sorted array.
+ *
+ * The batch of @p count elements, stored one by one at @p elems, is copied and sorted, 
+ * and then merged into the array in one backward pass, so every stored element is moved at most once.
+ * Loading k elements into an array of n elements costs O(n + k log k) instead of O(k * n) for k calls of saput().
+ * @return 0, if no error, -1 otherwise
+ */
+int saputn(struct sorted_array* array, void* elems, size_t count);
+
 /**
  * Remove an element specified by its index from sorted array.
  *
@@ -102,6 +406,24 @@ int sarm(struct sorted_array* array, size_t index);
  */
 int sarmall(struct sorted_array* array, void* elem);
 
+/**
+ * Remove all elements, for which @p pred returns nonzero, from a sorted array.
+ *
+ * The buffer is compacted in one forward pass, moving every kept element at most once,
+ * so removing k elements costs O(n) instead of O(k * n) for k calls of sarm().
+ * @p pred is called exactly once for every element, in order, so it may keep state in @p context.
+ * @param context an argument passed to every call of @p pred; it may be NULL.
+ * @return 0 on success, -1 in case of an error.
+ */
+int sarmif(struct sorted_array* array, int (*pred)(void* elem, void* context), void* context);
+
+/**
+ * Remove elements with indices in [@p from, @p to) from a sorted array.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int sarmrange(struct sorted_array* array, size_t from, size_t to);
+
 /**
  * Get sorted array length.
  *
@@ -118,6 +440,59 @@ size_t salen(struct sorted_array* array);
  */
 size_t safind(struct sorted_array* array, void* elem);
 
+/**
+ * Find a batch of elements in a sorted array.
+ *
+ * For every one of @p count keys, stored one by one at @p keys, the index of its first occurence is written to 
+ * @p out_indices, or (size_t)-1 if there is no such element.
+ * Sorted batches are found in one galloping sweep over the array. Other batches are found by groups of searches 
+ * running in lockstep with prefetching, which hides memory latency on arrays that don't fit in cache.
+ * Merges the write buffer, if there is one.
+ * @return A number of found keys, or (size_t)-1 in case of an error.
+ */
+size_t safindn(struct sorted_array* array, void* keys, size_t count, size_t* out_indices);
+
+/**
+ * Find the lower bound of an element in a sorted array.
+ *
+ * @return Index of the first element that is not less than @p elem, salen() if there is no such element,
+ * or (size_t)-1 in case of an error.
+ */
+size_t salower(struct sorted_array* array, void* elem);
+
+/**
+ * Find the upper bound of an element in a sorted array.
+ *
+ * @return Index of the first element that is greater than @p elem, salen() if there is no such element,
+ * or (size_t)-1 in case of an error.
+ */
+size_t saupper(struct sorted_array* array, void* elem);
+
+/**
+ * Find the range of elements between @p lo and @p hi inclusive.
+ *
+ * Performs two binary searches. The elements x with @p lo <= x <= @p hi have indices in [*@p begin, *@p end).
+ * sarange(array, x, x, ...) gives the range of elements equal to x.
+ * @return 0 on success, -1 in case of an error.
+ */
+int sarange(struct sorted_array* array, void* lo, void* hi, size_t* begin, size_t* end);
+
+/**
+ * Count elements equal to @p elem in O(log n).
+ *
+ * @return A number of elements equal to @p elem, or (size_t)-1 in case of an error.
+ */
+size_t sacount(struct sorted_array* array, void* elem);
+
+/**
+ * Get a pointer to the contiguous buffer with all elements of a sorted array.
+ *
+ * The element with index i is at offset i * elem_size. Merges the write buffer, if there is one.
+ * The pointer is valid until the next modification of the array.
+ * @return Pointer to the first element, or NULL in case of an error (e.g. for blocked arrays, whose elements aren't contiguous).
+ */
+void* sadata(struct sorted_array* array);
+
 /**
  * Compare an element of a sorted array, specified by @p index, with @p elem.
  *
@@ -126,14 +501,244 @@ size_t safind(struct sorted_array* array, void* elem);
  */
 int sacmp(struct sorted_array* array, size_t index, void* elem);
 
+/**
+ * Get a pointer to an element of a sorted array, the same as saget(), but without any checks.
+ *
+ * Unchecked functions are for hot loops, whose arguments are known to be valid: 
+ * they don't check them and never touch errno. Passing invalid arguments is undefined behaviour,
+ * though builds without NDEBUG catch it with assert().
+ * @p array must not be concurrent (see saconcurrent()), and @p index must be less than salen().
+ * @return Pointer to the element.
+ */
+void* saget_unchecked(struct sorted_array* array, size_t index);
+
+/**
+ * Compare an element of a sorted array with @p elem, the same as sacmp(), but without any checks.
+ *
+ * @see saget_unchecked()
+ */
+int sacmp_unchecked(struct sorted_array* array, size_t index, void* elem);
+
+/**
+ * Find the first occurence of an element, the same as safind(), but without any checks and without setting errno.
+ *
+ * Unlike saget_unchecked(), it doesn't return a pointer into the array, so @p array may be concurrent:
+ * the search runs on one consistent view of it.
+ * @see saget_unchecked()
+ * @return Index of the element, or (size_t)-1 if there is no such element.
+ */
+size_t safind_unchecked(struct sorted_array* array, void* elem);
+
+/**
+ * Turn the read-optimized search index of a sorted array on or off.
+ *
+ * The index is a copy of the elements in Eytzinger (BFS) order, which is searched without branching on the
+ * comparison results and with prefetching of the next levels. It lowers the number of cache misses and branch 
+ * mispredictions for arrays much larger than the CPU cache.
+ * The index is rebuilt lazily in O(n) by the first search after a modification, so it only pays off
+ * for arrays that are searched much more often than modified.
+ * @return 0 on success, -1 in case of an error.
+ */
+int saindex(struct sorted_array* array, int enable);
+
+/** @enum sa_key_type
+ * Primitive types of elements that sakeytype() can declare.
+ */
+enum sa_key_type
+{
+	SA_KEY_NONE,	///< Elements are compared by the comparator only
+	SA_KEY_INT32,	///< Elements are int32_t
+	SA_KEY_INT64,	///< Elements are int64_t
+	SA_KEY_FLOAT,	///< Elements are float
+	SA_KEY_DOUBLE	///< Elements are double
+};
+
+/**
+ * Declare that the elements of a sorted array are primitive keys of type @p type.
+ *
+ * Searches in such an array compare keys natively instead of calling the comparator, 
+ * and once the search window fits in a few cache lines they switch from bisection to a linear scan
+ * comparing 4-8 keys per instruction. The best of AVX2, SSE4.2 and scalar kernels is picked at runtime.
+ *
+ * @note The comparator must still be passed to sanew(), and it must order the keys in natural ascending order.
+ * @return 0 on success, -1 in case of an error.
+ */
+int sakeytype(struct sorted_array* array, enum sa_key_type type);
+
+/**
+ * Switch a sorted array to the blocked layout.
+ *
+ * A blocked array stores its elements in a sequence of sorted blocks of @p block_elems elements each,
+ * plus an index of the first element (fence key) of every block and of cumulative element counts.
+ * saput(), sarm() and sarmall() shift elements only within one block, splitting full blocks and merging
+ * nearly empty ones, so they cost O(block_elems + n / block_elems) instead of O(n).
+ * saget() and iterators find the block of an element by its index in O(log(n / block_elems)).
+ * Choosing @p block_elems close to sqrt(n) makes modifications O(sqrt(n)).
+ *
+ * The stored elements are kept, and the array stays blocked until it is deleted.
+ * @param block_elems number of elements in one block, or 0 to use blocks of 16 KiB.
+ * @return 0 on success, -1 in case of an error.
+ */
+int sablocks(struct sorted_array* array, size_t block_elems);
+
+/**
+ * Take a point-in-time snapshot of a blocked sorted array.
+ *
+ * The snapshot shares the block table and all blocks with @p array, so it costs O(1) whatever the size of the array.
+ * Shared blocks are reference counted, and the first change of either array after the snapshot copies the block table,
+ * O(n / block_elems), and then only the blocks it touches, so a scan of the snapshot sees the array as it was,
+ * while another thread keeps changing the array.
+ *
+ * The snapshot is a sorted array of its own, that is read with the same functions and iterators and deleted with sadelete().
+ * Changing it copies blocks the same way, so it never affects @p array.
+ * Snapshots are taken by the thread that modifies @p array.
+ * @note Changing elements in place through pointers returned by saget() bypasses copying and is seen by all snapshots.
+ * @return A pointer to the snapshot, or NULL in case of an error.
+ */
+struct sorted_array* sasnapshot(struct sorted_array* array);
+
+/**
+ * Set up a write buffer of a sorted array.
+ *
+ * saput() puts elements into a small sorted write buffer of @p count elements, shifting only inside it.
+ * When the buffer gets full, it is merged into the main buffer in one linear pass, 
+ * so an insertion costs amortized O(log n + count + n / count) instead of O(n).
+ * safind(), saget(), sacmp(), salen() and iterators consult both buffers, as if they were already merged.
+ * Other modifications merge the write buffer first.
+ *
+ * Blocked arrays can't have a write buffer.
+ * @param count capacity of the write buffer in elements, or 0 to merge and remove the write buffer.
+ * @return 0 on success, -1 in case of an error.
+ */
+int sawbuffer(struct sorted_array* array, size_t count);
+
+/**
+ * Merge the write buffer of a sorted array into the main buffer.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int saflush(struct sorted_array* array);
+
+/**
+ * Enable or disable lock-free reads of a sorted array, concurrent with one writing thread.
+ *
+ * saget(), saread(), salen(), safind(), safindn(), salower(), saupper(), sarange() and sacount() take no locks then.
+ * Every modification runs in a section guarded by a sequence number, a seqlock, and a read
+ * that overlapped a modification is retried, so readers don't block each other and scale with the number of cores.
+ * Buffers replaced on growth are kept until concurrent reads are disabled or the array is deleted,
+ * so a pointer returned by saget() stays valid, though the element it points to may be changed by the writer.
+ *
+ * Only one thread may modify the array at a time, and iterators are not protected.
+ * Blocked, indexed arrays and arrays with a write buffer can't be concurrent, and concurrent arrays can't shrink.
+ * @param enable nonzero to enable concurrent reads; disabling them must not overlap any read.
+ * @return 0 on success, -1 in case of an error.
+ */
+int saconcurrent(struct sorted_array* array, int enable);
+
+/**
+ * Put the union of sorted arrays @p a and @p b into @p dst.
+ *
+ * The arrays are treated as multisets, as by std::set_union(): an element that occurs x times in @p a 
+ * and y times in @p b occurs max(x, y) times in the result. The arrays must have the same element size
+ * and be ordered by the same comparator.
+ *
+ * All set operations run one linear merge of both arrays, writing the result straight into the buffer of @p dst.
+ * The previous contents of @p dst are discarded. @p dst grows if it is growable, otherwise it must have enough space.
+ * If the operation fails, @p dst keeps its previous contents.
+ * Where elements of one array are skipped, as in intersections, the skipping gallops if that array
+ * is much longer than the other one, or uses SIMD scans if it stores primitive keys (see sakeytype()).
+ * @return 0 on success, -1 in case of an error.
+ */
+int saunion(struct sorted_array* dst, struct sorted_array* a, struct sorted_array* b);
+
+/**
+ * Put the intersection of sorted arrays @p a and @p b into @p dst.
+ *
+ * An element that occurs x times in @p a and y times in @p b occurs min(x, y) times in the result.
+ * @return 0 on success, -1 in case of an error.
+ * @see saunion()
+ */
+int saintersect(struct sorted_array* dst, struct sorted_array* a, struct sorted_array* b);
+
+/**
+ * Put the difference of sorted arrays @p a and @p b into @p dst.
+ *
+ * An element that occurs x times in @p a and y times in @p b occurs max(x - y, 0) times in the result.
+ * @return 0 on success, -1 in case of an error.
+ * @see saunion()
+ */
+int sadiff(struct sorted_array* dst, struct sorted_array* a, struct sorted_array* b);
+
+/**
+ * Put the symmetric difference of sorted arrays @p a and @p b into @p dst.
+ *
+ * An element that occurs x times in @p a and y times in @p b occurs |x - y| times in the result.
+ * @return 0 on success, -1 in case of an error.
+ * @see saunion()
+ */
+int sasymdiff(struct sorted_array* dst, struct sorted_array* a, struct sorted_array* b);
+
+/**
+ * Count elements in the intersection of sorted arrays @p a and @p b, without storing it.
+ *
+ * @return The size of the intersection, or (size_t)-1 in case of an error.
+ * @see saintersect()
+ */
+size_t saintersectcount(struct sorted_array* a, struct sorted_array* b);
+
+/**
+ * Merge sorted arrays into one.
+ *
+ * Replaces the contents of @p dst with all elements of @p count @p arrays in sorted order,
+ * writing every element once, straight into the buffer of @p dst. Equal elements keep the order of @p arrays.
+ * All arrays must have the same element size and be ordered by the same comparator.
+ * @p dst grows if it is growable, otherwise it must have enough space. If the merge fails, @p dst keeps its previous contents.
+ * @return 0 on success, -1 in case of an error.
+ * @see sa_merge_iter
+ */
+int samerge(struct sorted_array* dst, struct sorted_array** arrays, size_t count);
+
 /**
  * Sort array again in case when relations of order between stored elements change.
  * 
- * Invoke qsort() on an array to restore broken order.
+ * The sort adapts to the contents: sorted runs already present in the array are detected and merged,
+ * so an array with r runs is sorted in O(n log r). If the runs are short, arrays of primitive keys (see sakeytype())
+ * are radix sorted instead, without calling the comparator, and other large arrays are sorted by a parallel merge sort,
+ * if sathreads() allows more than one thread. Everything else, and each of these sorts that can't allocate
+ * its temporary memory, falls back to qsort().
+ *
+ * If changed elements were marked by satouch() or satouchrange(), only they are sorted and merged back in one linear pass.
  * @return 0 on success, -1 on error
  */
 int saresort(struct sorted_array* array);
 
+/**
+ * Mark the element at @p index as changed, so that the next saresort() sorts only marked elements.
+ *
+ * Unmarked elements must keep their order. Marks are dropped by saresort(), and any change of the array
+ * between marking and saresort(), as well as marking too many elements, makes saresort() sort the whole array.
+ * @return 0 on success, -1 in case of an error.
+ */
+int satouch(struct sorted_array* array, size_t index);
+
+/**
+ * Mark elements with indices in [@p from, @p to) as changed.
+ *
+ * @see satouch()
+ * @return 0 on success, -1 in case of an error.
+ */
+int satouchrange(struct sorted_array* array, size_t from, size_t to);
+
+/**
+ * Set the number of threads saresort() may use for a sorted array.
+ *
+ * Arrays of 16384 elements and more are split into @p threads chunks, that are sorted concurrently
+ * and then merged pairwise, every round of merges running concurrently as well.
+ * @param threads number of threads, 0 and 1 meaning sorting in the calling thread only.
+ * @return 0 on success, -1 in case of an error.
+ */
+int sathreads(struct sorted_array* array, size_t threads);
+
 /**
  * Call @p func on every element of an array.
  */
@@ -200,4 +805,356 @@ int sainext(struct sa_iter* it);
  * @returns Pointer to the current element, or NULL, in case of an error.
  */
 void* saiget(struct sa_iter* it);
+
+// ------------------------------  MERGE ITERATOR -----------------------------
+
+/** @struct sa_merge_iter
+ * Iterator producing one sorted stream of elements of many sorted arrays.
+ *
+ * The next element is chosen by a loser tree, so every step costs O(log k) comparisons for k arrays.
+ * Equal elements go in the order of the arrays.
+ * All arrays must have the same element size and be ordered by the same comparator,
+ * and they must not be modified while the iterator is used.
+ *
+ * @b Example
+ * ~~~~~~~~~~~~~~~~~{.c}
+ * struct sa_merge_iter* it;
+ * for (it = samnew(shards, nshards); !samend(it); samnext(it))
+ *     printf("%d ", *(int*)samget(it));
+ * samdelete(it);
+ * ~~~~~~~~~~~~~~~~~
+ */
+struct sa_merge_iter;
+
+/**
+ * Create a new merge iterator over @p count sorted @p arrays.
+ *
+ * Merges write buffers of the arrays, if they have them.
+ * @return Pointer to the newly created iterator, or NULL in case of an error.
+ */
+struct sa_merge_iter* samnew(struct sorted_array** arrays, size_t count);
+
+/**
+ * Delete merge iterator.
+ */
+void samdelete(struct sa_merge_iter* it);
+
+/**
+ * Check, whether the merge iterator has iterated all elements of all arrays.
+ *
+ * @return 
+ * 0, if the end is not reached; \n
+ * 1, if all the elements have been iterated; \n
+ * -1 in case of an error.
+ */
+int samend(struct sa_merge_iter* it);
+
+/**
+ * Shifts the merge iterator to the next element.
+ * 
+ * @return 0 if no error; -1 in case of an error.
+ */
+int samnext(struct sa_merge_iter* it);
+
+/**
+ * Get a pointer to the current element under the merge iterator.
+ *
+ * @returns Pointer to the current element, or NULL, in case of an error.
+ */
+void* samget(struct sa_merge_iter* it);
+
+// ------------------------------  SHARDED ARRAY -----------------------------
+
+/** @struct sa_shards
+ * Sorted array split into shards by key ranges, that many threads can insert into at once.
+ *
+ * Every shard is a sorted array of its own with its own lock, so insertions of keys owned by different shards run in parallel,
+ * and each of them shifts only the elements of one shard.
+ * A shard, that grows over its limit, is split in halves, and a shard, that shrinks below 1/8 of it, is merged into a neighbour.
+ * Equal elements are always kept in one shard.
+ *
+ * Elements are addressed by their global ranks, which are counted from the lengths of the shards.
+ * Ranks and lengths are exact when no other thread modifies the array at the same time.
+ */
+struct sa_shards;
+
+/**
+ * Create a new sharded array.
+ *
+ * @param elem_size size of one element in bytes
+ * @param shard_elems number of elements, after which a shard is split
+ * @param compar comparator function, the same as for sanew()
+ * @return A pointer to newly created array, or NULL in case of an error.
+ */
+struct sa_shards* sashnew(ssize_t elem_size, size_t shard_elems, int (*compar)(const void* a, const void* b));
+
+/**
+ * Delete a sharded array. No other thread may use it at that time.
+ */
+void sashdelete(struct sa_shards* sh);
+
+/**
+ * Put an element into the shard owning it, splitting the shard if it got too large.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int sashput(struct sa_shards* sh, void* elem);
+
+/**
+ * Remove all elements equal to @p elem, merging their shard into a neighbour if it got too small.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int sashrmall(struct sa_shards* sh, void* elem);
+
+/**
+ * Copy the element with global rank @p index to @p out.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int sashget(struct sa_shards* sh, size_t index, void* out);
+
+/**
+ * Find the first occurence of an element.
+ *
+ * @return The global rank of the element, or (size_t)-1 if it is absent or in case of an error.
+ */
+size_t sashfind(struct sa_shards* sh, void* elem);
+
+/**
+ * Get the number of elements in all shards.
+ *
+ * @return The number of elements, or (size_t)-1 in case of an error.
+ */
+size_t sashlen(struct sa_shards* sh);
+
+/**
+ * Get the number of shards.
+ *
+ * @return The number of shards, or (size_t)-1 in case of an error.
+ */
+size_t sashcount(struct sa_shards* sh);
+
+// ----------------------------  EXTERNAL MEMORY ------------------------------
+
+/** @struct sa_xbuilder
+ * Builder of a sorted array in a file, that takes any number of elements in any order using bounded memory.
+ *
+ * Elements are collected in memory, and every time the memory is full, they are sorted and saved as a run
+ * to an unlinked file in the directory of the output. saxfinish() merges the runs, at most 64 of them at once,
+ * in as many passes as it takes, and the last pass writes the output.
+ * The output is a file of saopen() format, so it can be opened with saopen() as well, when it fits in memory.
+ */
+struct sa_xbuilder;
+
+/**
+ * Start building a sorted array in the file at @p path, replacing it.
+ *
+ * @param mem_elems number of elements kept in memory, at least 2
+ * @param compar comparator function, the same as for sanew()
+ * @return A pointer to the new builder, or NULL in case of an error.
+ */
+struct sa_xbuilder* saxnew(const char* path, ssize_t elem_size, size_t mem_elems, 
+	int (*compar)(const void* a, const void* b));
+
+/**
+ * Put an element into the array being built.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int saxput(struct sa_xbuilder* b, void* elem);
+
+/**
+ * Put @p count elements from @p elems into the array being built.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int saxputn(struct sa_xbuilder* b, void* elems, size_t count);
+
+/**
+ * Merge all runs into the output file, and delete the builder, even if it fails.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int saxfinish(struct sa_xbuilder* b);
+
+/** @struct sa_xarray
+ * Read-only sorted array in a file of saopen() format, that is searched without loading it into memory.
+ *
+ * The file is split into blocks, and the first element of every block is kept in memory as a fence.
+ * A search finds its block among the fences, and reads only that block with pread(), 
+ * so it costs one read whatever the size of the file. The last block read is cached.
+ *
+ * The array is not thread-safe, because of its block cache.
+ */
+struct sa_xarray;
+
+/**
+ * Open a file built by saxfinish() or saved by a file-backed array (see saopen()).
+ *
+ * @param block_elems number of elements in a block, or 0 to use blocks of 64 KiB
+ * @param compar comparator function, the same as for sanew()
+ * @return A pointer to the opened array, or NULL in case of an error.
+ */
+struct sa_xarray* saxopen(const char* path, ssize_t elem_size, size_t block_elems, 
+	int (*compar)(const void* a, const void* b));
+
+/**
+ * Close an external array.
+ */
+void saxclose(struct sa_xarray* x);
+
+/**
+ * Get the number of elements in an external array.
+ *
+ * @return The number of elements, or (size_t)-1 in case of an error.
+ */
+size_t saxlen(struct sa_xarray* x);
+
+/**
+ * Copy the element with index @p index to @p out.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int saxget(struct sa_xarray* x, size_t index, void* out);
+
+/**
+ * Copy elements with indices in [@p from, @p to) to @p out, reading them at once.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int saxread(struct sa_xarray* x, size_t from, size_t to, void* out);
+
+/**
+ * Find the first occurence of an element, the same as safind().
+ *
+ * @return The index of the element, or (size_t)-1 if it is absent or in case of an error.
+ */
+size_t saxfind(struct sa_xarray* x, void* elem);
+
+/**
+ * Find the first element, that is not less than @p elem, the same as salower().
+ *
+ * @return Its index, or (size_t)-1 in case of an error.
+ */
+size_t saxlower(struct sa_xarray* x, void* elem);
+
+/**
+ * Find the first element, that is greater than @p elem, the same as saupper().
+ *
+ * @return Its index, or (size_t)-1 in case of an error.
+ */
+size_t saxupper(struct sa_xarray* x, void* elem);
+
+/**
+ * Find the range of elements in [@p lo, @p hi], the same as sarange().
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int saxrange(struct sa_xarray* x, void* lo, void* hi, size_t* begin, size_t* end);
+
+// -------------------------------  SORTED MAP --------------------------------
+
+/** @struct sorted_map
+ * Map from keys to values, sorted by the keys, with unique keys.
+ *
+ * Keys are kept in a flat sorted array of their own, and values in a separate buffer in the same order,
+ * so searches touch only the dense keys, and as many of them fit in a cache line as possible.
+ * A sorted array of {key, value} structs would drag values through the cache on every probe.
+ */
+struct sorted_map;
+
+/**
+ * Create a new sorted map.
+ *
+ * @param key_size size of one key in bytes
+ * @param value_size size of one value in bytes; may be 0
+ * @param max_elems max number of keys
+ * @param compar comparator of keys, the same as for sanew()
+ * @return A pointer to newly created map, or NULL in case of an error.
+ */
+struct sorted_map* smnew(ssize_t key_size, ssize_t value_size, ssize_t max_elems, 
+	int (*compar)(const void* a, const void* b));
+
+/**
+ * Delete a sorted map.
+ */
+void smdelete(struct sorted_map* map);
+
+/**
+ * Turn growable mode of a sorted map on or off, the same as sagrowable().
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int smgrowable(struct sorted_map* map, int growable);
+
+/**
+ * Declare that the keys of a sorted map are primitive keys of type @p type, the same as sakeytype().
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int smkeytype(struct sorted_map* map, enum sa_key_type type);
+
+/**
+ * Put @p key with @p value into a sorted map, or replace the value of @p key, if it is already there.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int smput(struct sorted_map* map, const void* key, const void* value);
+
+/**
+ * Remove @p key with its value from a sorted map.
+ *
+ * @return 0 on success, -1 in case of an error.
+ */
+int smrm(struct sorted_map* map, const void* key);
+
+/**
+ * Find the value of @p key.
+ *
+ * @return Pointer to the value, valid until the next modification of the map, or NULL in case of an error.
+ */
+void* smfind(struct sorted_map* map, const void* key);
+
+/**
+ * Find the lower bound of @p key.
+ *
+ * @return Index of the first key that is not less than @p key, or (size_t)-1 in case of an error.
+ */
+size_t smlower(struct sorted_map* map, const void* key);
+
+/**
+ * Get the number of keys in a sorted map.
+ *
+ * @return The number of keys, or (size_t)-1 in case of an error.
+ */
+size_t smlen(struct sorted_map* map);
+
+/**
+ * Get a pointer to the key with index @p index.
+ *
+ * @return Pointer to the key, or NULL in case of an error.
+ */
+void* smkey(struct sorted_map* map, size_t index);
+
+/**
+ * Get a pointer to the value of the key with index @p index.
+ *
+ * @return Pointer to the value, or NULL in case of an error.
+ */
+void* smvalue(struct sorted_map* map, size_t index);
+
+/**
+ * Get a pointer to the contiguous buffer of keys, the same as sadata().
+ *
+ * @return Pointer to the first key, or NULL in case of an error.
+ */
+void* smkeys(struct sorted_map* map);
+
+/**
+ * Get a pointer to the contiguous buffer of values, in the order of their keys.
+ *
+ * @return Pointer to the first value, or NULL in case of an error.
+ */
+void* smvalues(struct sorted_map* map);
 #endif